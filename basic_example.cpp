@@ -8,14 +8,13 @@
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "examples.h"
 
 // A minimal example to showcase how the rendering framework works
 // User must define themselves: Vertex struct, Varying struct, ShaderProgram (complete with
-// vertex shader, fragment shader and interpolate functions), and provide the Vertex and Index
-// buffers for drawing
+// vertex shader and fragment shader functions), and provide the Vertex and Index buffers for drawing.
+// Varyings are interpolated automatically
 
 namespace BasicExample {
 	// Vertex struct
@@ -24,14 +23,15 @@ namespace BasicExample {
 		glm::vec3 col;
 	};
 
-	// IMPORTANT: Varying struct MUST contain glm::vec4 gl_Position member, which has the result of the MVP transform written to in vertex shader
+	// IMPORTANT: Varying struct MUST start with a glm::vec4 gl_Position member, which has the result of the MVP transform written to in vertex shader,
+	// and otherwise contain only float based members (float, glm::vec2, glm::vec3, ...) so it can be interpolated automatically
 	struct Varying {
 		glm::vec4 gl_Position;
 		glm::vec3 col;
 	};
 
 	// Example ShaderProgram that only interpolates vertex colour attributes
-	struct ColourProgram : public IShaderProgram<Vertex, Varying> {
+	struct ColourProgram final : public IShaderProgram<Vertex, Varying> {
 		// Uniforms can simply be provided as member fields of the ShaderProgram, with setters if needed
 		glm::mat4 m_view;// = glm::lookAt(glm::vec3(0, 0, 6.0), glm::vec3(0.0), glm::vec3(0.0, 1.0, 0.0));
 		glm::mat4 m_projection;// = glm::perspective(glm::radians(60.f), (float)1280 / 720, 0.1f, 100.0f);
@@ -51,12 +51,6 @@ namespace BasicExample {
 		virtual glm::vec3 fragmentShader(const Varying& interpolatedInput) {
 			return interpolatedInput.col;
 		}
-
-		virtual Varying interpolate(const Varying& a, const Varying& b, const Varying& c, float ba, float bb, float bc) {
-			Varying ret{};
-			ret.col = ba * a.col + bb * b.col + bc * c.col;
-			return ret;
-		}
 	};
 
 	int run(bool openGLComparison) {
@@ -83,7 +77,10 @@ namespace BasicExample {
 
 		std::vector<int> indices{ 0, 1, 2, 3, 4, 5 };
 
-		renderer.draw(program, vertices, indices, "Output/basic_example.tga");
+		renderer.beginFrame();
+		renderer.draw(program, vertices, indices);
+		renderer.endFrame();
+		renderer.present("Output/basic_example.tga");
 
 		if (!openGLComparison) return 0;
         return OpenGLRender(width, height, vertices, projection, view);
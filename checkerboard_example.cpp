@@ -24,7 +24,7 @@ namespace CheckerboardExample {
 		glm::vec2 texCoords;
 	};
 
-	struct TextureProgram : public IShaderProgram<Vertex, Varying> {
+	struct TextureProgram final : public IShaderProgram<Vertex, Varying> {
 
 		glm::mat4 m_view;
 		glm::mat4 m_projection;
@@ -33,7 +33,7 @@ namespace CheckerboardExample {
 		TextureProgram(glm::mat4 view, glm::mat4 projection, const char* texturePath) :
 			m_view(view),
 			m_projection(projection),
-			m_sampler(texturePath, BILINEAR, MIRROR)
+			m_sampler(texturePath, TRILINEAR, MIRROR)
 		{}
 
 		virtual Varying vertexShader(const Vertex& input) {
@@ -47,10 +47,11 @@ namespace CheckerboardExample {
 			return m_sampler(interpolatedInput.texCoords.x, interpolatedInput.texCoords.y);
 		}
 
-		virtual Varying interpolate(const Varying& a, const Varying& b, const Varying& c, float ba, float bb, float bc) {
-			Varying ret{};
-			ret.texCoords = ba * a.texCoords + bb * b.texCoords + bc * c.texCoords;
-			return ret;
+		// Used instead of the above when drawing a TextureProgram directly: the texture coordinate derivatives across
+		// the quad choose the mip levels, so the far end of the plane samples small levels rather than aliasing
+		glm::vec3 fragmentShader(const FragmentQuad<Varying>& quad) {
+			glm::vec2 texCoords = quad.fragment().texCoords;
+			return m_sampler(texCoords.x, texCoords.y, quad.dFdx(&Varying::texCoords), quad.dFdy(&Varying::texCoords));
 		}
 	};
 
@@ -75,7 +76,10 @@ namespace CheckerboardExample {
 		// Two triangles forming the plane quad
 		std::vector<int> indices{ 0, 2, 1, 1, 2, 3 };
 
-		renderer.draw(program, vertices, indices, "Output/checkerboard_example.tga");
+		renderer.beginFrame();
+		renderer.draw(program, vertices, indices);
+		renderer.endFrame();
+		renderer.present("Output/checkerboard_example.tga");
 
         if (!openGLComparison) return 0;
         return OpenGLRender(width, height, vertices, indices, projection, view);
@@ -201,12 +205,12 @@ namespace CheckerboardExample {
         glGenTextures(1, &texture);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imWidth, imHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        //glGenerateMipmap(GL_TEXTURE_2D);
+        glGenerateMipmap(GL_TEXTURE_2D);
         stbi_image_free(data);
 
 
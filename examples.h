@@ -14,4 +14,6 @@ namespace TextureTests {
 
 namespace ModelExample {
 	int run();
+	int benchmark(int frames = 10);
+	int orbit(int frames = 60);
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "frameWriter.h"
+#include <algorithm>
+
+FrameWriter::FrameWriter(int maxFrames, int threadCount) :
+	m_maxFrames(std::max(maxFrames, 1))
+{
+	threadCount = std::clamp(threadCount, 1, m_maxFrames);
+	for (int i = 0; i < threadCount; i++) {
+		m_workers.emplace_back(&FrameWriter::worker_loop, this);
+	}
+}
+
+FrameWriter::~FrameWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	// workers drain the queue before stopping
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void FrameWriter::submit(Framebuffer& framebuffer, const char* filename, imageFormat format)
+{
+	Frame* frame;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_written.wait(lock, [this] { return !m_free.empty() || (int)m_frames.size() < m_maxFrames; });
+		if (m_free.empty()) {
+			m_frames.push_back(std::make_unique<Frame>());
+			frame = m_frames.back().get();
+		}
+		else {
+			frame = m_free.back();
+			m_free.pop_back();
+		}
+		m_inFlight++;
+	}
+
+	// the copy is made outside the lock, so writers are not held up by it
+	frame->image = framebuffer.image(frame->pixels);
+	frame->filename = filename;
+	frame->format = format;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.push_back(frame);
+	}
+	m_wake.notify_one();
+}
+
+bool FrameWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_written.wait(lock, [this] { return m_inFlight == 0; });
+	bool ok = !m_failed;
+	m_failed = false;
+	return ok;
+}
+
+void FrameWriter::worker_loop()
+{
+	// each thread keeps its own encoders, one per format as first needed, so frames reuse them without sharing
+	std::unique_ptr<ImageEncoder> encoders[IMAGE_FORMATS];
+	for (;;) {
+		Frame* frame;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this] { return !m_queue.empty() || m_stop; });
+			if (m_queue.empty()) return;
+			frame = m_queue.front();
+			m_queue.pop_front();
+		}
+
+		// encoded on this thread alone: the renderer's thread pool is busy with the frames being rendered meanwhile
+		std::unique_ptr<ImageEncoder>& encoder = encoders[frame->format];
+		if (!encoder) {
+			encoder = make_image_encoder(frame->format);
+		}
+		bool ok = encoder->encode(frame->image, frame->encoded) && write_file(frame->filename.c_str(), frame->encoded);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_failed |= !ok;
+			m_free.push_back(frame);
+			m_inFlight--;
+		}
+		m_written.notify_all();
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "framebuffer.h"
+#include "imageEncoder.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Writes frames out on background threads, so that a sequence of frames can be rendered while earlier ones are
+// still being encoded and written. Each submitted frame is copied into one of a fixed number of buffers owned by
+// the writer, which caps the memory used however far rendering gets ahead: once every buffer is in flight, submit
+// waits for one to be written. Buffers are allocated on first use and then reused, as are the encoded outputs
+class FrameWriter {
+private:
+	struct Frame {
+		std::vector<rgba8_t> pixels;
+		std::vector<uint8_t> encoded;
+		ImageView image;
+		std::string filename;
+		imageFormat format;
+	};
+	std::vector<std::unique_ptr<Frame>> m_frames;
+	std::vector<Frame*> m_free; // buffers not in flight
+	std::deque<Frame*> m_queue; // frames waiting for a writer thread, in submission order
+	int m_maxFrames;
+	int m_inFlight = 0; // frames queued or being written
+	bool m_failed = false; // whether any write failed since the last flush
+	bool m_stop = false;
+	std::mutex m_mutex;
+	std::condition_variable m_wake; // signalled when a frame is queued, or on shutdown
+	std::condition_variable m_written; // signalled when a frame has been written
+	std::vector<std::thread> m_workers;
+	void worker_loop();
+public:
+	// maxFrames (at least 1) buffers, written by threadCount (at least 1) threads. Frames are written concurrently
+	// when there is more than one thread, so may finish out of order
+	FrameWriter(int maxFrames = 2, int threadCount = 1);
+	// waits for every submitted frame to be written
+	~FrameWriter();
+	// Copies the framebuffer's colour image (resolving any deferred clear) to be written to a file in the given
+	// format, waiting first if every buffer is in flight. The framebuffer can be drawn to again as soon as it returns
+	void submit(Framebuffer& framebuffer, const char* filename, imageFormat format = TGA);
+	// Waits for every submitted frame to be written. Returns false if any of the writes since the last flush failed
+	bool flush();
+	// disable copy constructor and assignment operator
+	FrameWriter(const FrameWriter&) = delete;
+	FrameWriter& operator=(const FrameWriter&) = delete;
+};
@@ -0,0 +1,111 @@
+#include "framebuffer.h"
+#include <algorithm>
+
+Framebuffer::Framebuffer(int width, int height) :
+	m_width(width),
+	m_height(height)
+{
+	m_tilesX = (width + TILE_SIZE - 1) >> TILE_BITS;
+	m_tilesY = (height + TILE_SIZE - 1) >> TILE_BITS;
+	m_blocksX = (width + BLOCK_SIZE - 1) >> BLOCK_BITS;
+	m_blocksY = (height + BLOCK_SIZE - 1) >> BLOCK_BITS;
+	size_t pixels = size_t(m_tilesX) * m_tilesY * TILE_SIZE * TILE_SIZE;
+	m_colour.resize(pixels / (BLOCK_SIZE * BLOCK_SIZE));
+	m_zbuffer.resize(pixels);
+	m_blockMinZ.resize(m_blocksX * m_blocksY);
+	m_blockMaxZ.resize(m_blocksX * m_blocksY);
+	m_tileMaxZ.resize(m_tilesX * m_tilesY);
+	m_tileClear.resize(m_tilesX * m_tilesY);
+	clear();
+}
+
+void Framebuffer::clear(glm::vec3 colour)
+{
+	clearColour(colour);
+	clearDepth();
+}
+
+void Framebuffer::clearColour(glm::vec3 colour)
+{
+	m_clearColour = pack(colour);
+	for (uint8_t& flags : m_tileClear) {
+		flags |= CLEAR_COLOUR;
+	}
+}
+
+void Framebuffer::clearDepth()
+{
+	// tile bounds are reset now, as they are read to reject triangles before the tile is prepared
+	std::fill(m_tileMaxZ.begin(), m_tileMaxZ.end(), ZBUFFMAX);
+	for (uint8_t& flags : m_tileClear) {
+		flags |= CLEAR_DEPTH;
+	}
+}
+
+void Framebuffer::clear_tile(int tile, uint8_t flags)
+{
+	// each tile is contiguous, so is cleared (padding included) in one go
+	size_t first = size_t(tile) * TILE_SIZE * TILE_SIZE;
+	if (flags & CLEAR_COLOUR) {
+		std::fill_n(colour_data() + first, TILE_SIZE * TILE_SIZE, m_clearColour);
+	}
+	if (flags & CLEAR_DEPTH) {
+		std::fill_n(m_zbuffer.begin() + first, TILE_SIZE * TILE_SIZE, ZBUFFMAX);
+		constexpr int TILE_BLOCKS = TILE_SIZE / BLOCK_SIZE;
+		int tx = tile % m_tilesX, ty = tile / m_tilesX;
+		int bxBegin = tx * TILE_BLOCKS, bxEnd = std::min(bxBegin + TILE_BLOCKS, m_blocksX);
+		int byBegin = ty * TILE_BLOCKS, byEnd = std::min(byBegin + TILE_BLOCKS, m_blocksY);
+		for (int by = byBegin; by < byEnd; by++) {
+			std::fill(m_blockMinZ.begin() + by * m_blocksX + bxBegin, m_blockMinZ.begin() + by * m_blocksX + bxEnd, ZBUFFMAX);
+			std::fill(m_blockMaxZ.begin() + by * m_blocksX + bxBegin, m_blockMaxZ.begin() + by * m_blocksX + bxEnd, ZBUFFMAX);
+		}
+	}
+	m_tileClear[tile] &= ~flags;
+}
+
+void Framebuffer::resolve()
+{
+	for (int tile = 0; tile < int(m_tileClear.size()); tile++) {
+		if (m_tileClear[tile] & CLEAR_COLOUR) {
+			clear_tile(tile, CLEAR_COLOUR);
+		}
+	}
+}
+
+void Framebuffer::enable_visibility()
+{
+	if (m_visibility.empty()) {
+		m_visibility.assign(m_zbuffer.size(), NO_TRIANGLE);
+	}
+}
+
+ImageView Framebuffer::image()
+{
+	return image(m_linear);
+}
+
+ImageView Framebuffer::image(std::vector<rgba8_t>& rows)
+{
+	resolve();
+	// gathered into linear rows a block row at a time
+	rows.resize(size_t(m_width) * m_height);
+	rgba8_t* out = rows.data();
+	for (int y = 0; y < m_height; y++) {
+		for (int x = 0; x < m_width; x += BLOCK_SIZE) {
+			int count = std::min(BLOCK_SIZE, m_width - x);
+			std::copy_n(colour_span(x, y), count, out);
+			out += count;
+		}
+	}
+	return ImageView{ rows.data() + size_t(m_height - 1) * m_width, -ptrdiff_t(m_width), m_width, m_height };
+}
+
+bool Framebuffer::write_image(const char* filename, imageFormat format, ThreadPool* threadPool)
+{
+	// encoders are kept for the next frame written in the same format, rather than made for every present
+	std::unique_ptr<ImageEncoder>& encoder = m_encoders[format];
+	if (!encoder) {
+		encoder = make_image_encoder(format);
+	}
+	return encoder->encode(image(), m_encoded, threadPool) && write_file(filename, m_encoded);
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "simd.h"
+#include "imageEncoder.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <limits>
+
+// Rasterization walks the screen in square blocks of 2^BLOCK_BITS pixels a side (8x8 by default), so that
+// blocks entirely outside or inside a triangle can be handled without any per pixel edge tests
+#ifndef BLOCK_BITS
+#define BLOCK_BITS 3
+#endif
+constexpr int BLOCK_SIZE = 1 << BLOCK_BITS;
+
+// In BINNED mode the screen is split into square tiles of 2^TILE_BITS pixels a side, each rasterized by a
+// single thread which therefore owns that region of the colour and depth buffers
+#ifndef TILE_BITS
+#define TILE_BITS 6
+#endif
+constexpr int TILE_SIZE = 1 << TILE_BITS;
+static_assert(TILE_BITS >= BLOCK_BITS, "tiles must be made up of whole blocks");
+
+typedef uint16_t zbuffer_t;
+constexpr auto ZBUFFMAX = std::numeric_limits<zbuffer_t>::max();
+constexpr uint32_t NO_TRIANGLE = UINT32_MAX; // visibility buffer value of pixels not covered in the current draw
+
+// 8 bit per channel RGBA colour, R in the lowest byte (so R, G, B, A in memory), as packed by simd::pack_unorm8
+typedef uint32_t rgba8_t;
+
+// Everything a Renderer draws into: the colour image, the depth buffer along with its hierarchical z bounds, and
+// (once needed) the visibility buffer. It lives as long as its Renderer, so is allocated once however many draws
+// and frames are rendered into it. Row 0 is the bottom of the image, as for OpenGL's window coordinates.
+// Per pixel buffers are stored tile-major, to match how they are rasterized: each tile is contiguous, made up of
+// its blocks in row-major order, each of which is itself contiguous and row-major. So a block occupies a couple of
+// cache lines rather than a row's worth per buffer, and a tile is a few KB that only its thread ever writes to in
+// BINNED mode. Buffers are padded to whole tiles, and only converted to linear rows when the image is written out
+class Framebuffer {
+private:
+	// blocks of the colour buffer, aligned so that no row of a block (one SIMD write of fragments) straddles cache lines
+	struct alignas(64) ColourBlock {
+		rgba8_t pixels[BLOCK_SIZE * BLOCK_SIZE];
+	};
+	static_assert(sizeof(ColourBlock) == sizeof(rgba8_t) * BLOCK_SIZE * BLOCK_SIZE, "blocks must be contiguous to be viewed as one array");
+	std::vector<ColourBlock> m_colour;
+	int m_width, m_height;
+	std::vector<zbuffer_t> m_zbuffer;
+	std::vector<uint32_t> m_visibility; // triangle ID per pixel, same layout as the zbuffer (VISIBILITY_BUFFER only)
+	std::vector<rgba8_t> m_linear; // the colour image in linear rows, only filled to write it out
+	std::vector<uint8_t> m_encoded;
+	std::unique_ptr<ImageEncoder> m_encoders[IMAGE_FORMATS]; // by format, created when first written in
+
+	// Hierarchical z: bounds on the zbuffer values (of pixels inside the image) of each block, and the upper bound
+	// of each tile (the largest of its blocks'). Blocks, and whole triangles within a tile, that lie entirely
+	// behind them are rejected before any per pixel work, and blocks entirely in front of them skip the depth
+	// compare. Kept conservative cheaply: the lower bound drops whenever a triangle writes to the block, the
+	// upper bound only when a triangle covers the whole block
+	int m_blocksX, m_blocksY;
+	int m_tilesX, m_tilesY;
+	std::vector<zbuffer_t> m_blockMinZ, m_blockMaxZ, m_tileMaxZ;
+
+	// Clears are deferred per tile: a clear only sets flags (and resets each tile's upper z bound, which the
+	// rasterizer tests before touching a tile), and each tile is actually cleared when first drawn to. Tiles still
+	// flagged for a colour clear once the frame is done are filled by resolve. So a clear costs O(tiles), and a
+	// tile drawn to costs no more than with an eager clear
+	static constexpr uint8_t CLEAR_COLOUR = 1, CLEAR_DEPTH = 2;
+	std::vector<uint8_t> m_tileClear;
+	rgba8_t m_clearColour;
+
+	// Index of pixel (x, y) in the per pixel buffers. Pixels from x to the end of its block row (so any SIMD row
+	// starting at x, as SIMD rows never cross blocks) are at consecutive indices
+	size_t pixel_index(int x, int y) const {
+		constexpr int TILE_BLOCK_BITS = TILE_BITS - BLOCK_BITS;
+		constexpr int TILE_BLOCK_MASK = (1 << TILE_BLOCK_BITS) - 1;
+		size_t tile = size_t(y >> TILE_BITS) * m_tilesX + (x >> TILE_BITS);
+		int block = (((y >> BLOCK_BITS) & TILE_BLOCK_MASK) << TILE_BLOCK_BITS) | ((x >> BLOCK_BITS) & TILE_BLOCK_MASK);
+		int pixel = ((y & (BLOCK_SIZE - 1)) << BLOCK_BITS) | (x & (BLOCK_SIZE - 1));
+		return (tile << (2 * TILE_BITS)) | (block << (2 * BLOCK_BITS)) | pixel;
+	}
+	// the colour buffer as one flat array of pixels, indexed by pixel_index
+	rgba8_t* colour_data() { return reinterpret_cast<rgba8_t*>(m_colour.data()); }
+	const rgba8_t* colour_data() const { return reinterpret_cast<const rgba8_t*>(m_colour.data()); }
+	rgba8_t* colour_span(int x, int y) { return colour_data() + pixel_index(x, y); }
+	zbuffer_t* depth_span(int x, int y) { return m_zbuffer.data() + pixel_index(x, y); }
+	uint32_t* visibility_span(int x, int y) { return m_visibility.data() + pixel_index(x, y); }
+	// allocates the visibility buffer, with every pixel NO_TRIANGLE, if it is not yet
+	void enable_visibility();
+	// performs any clear deferred for the tile, which must be done before it is drawn to
+	void prepare_tile(int tile) {
+		if (m_tileClear[tile]) {
+			clear_tile(tile, m_tileClear[tile]);
+		}
+	}
+	void clear_tile(int tile, uint8_t flags);
+	template <typename Vertex, typename Varying>
+	friend class Renderer;
+public:
+	Framebuffer(int width, int height);
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	// clears colour (clamped to [0, 1]) and depth (to the far plane)
+	void clear(glm::vec3 colour = glm::vec3(0.f));
+	void clearColour(glm::vec3 colour);
+	void clearDepth();
+	// fills every tile whose colour clear is still deferred, i.e. that was not drawn to since the clear
+	void resolve();
+	// colour channels are clamped to [0, 1]
+	static rgba8_t pack(glm::vec3 colour) {
+		glm::vec3 col = glm::clamp(colour, 0.f, 1.f);
+		col = col * glm::vec3(255) + glm::vec3(0.5); // convert from [0.f,1.f] colourspace to [0, 255]
+		return rgba8_t(col.x) | rgba8_t(col.y) << 8 | rgba8_t(col.z) << 16 | 0xFF000000u;
+	}
+	// Inline and unchecked, as it is called for every shaded fragment. x and y must be inside the image
+	void set(int x, int y, glm::vec3 colour) {
+		*colour_span(x, y) = pack(colour);
+	}
+	// Writes the lanes of laneMask of SIMD row colours (packed RGBA8) to the WIDTH pixels from (x, y), which must
+	// not cross a block (true of any SIMD row starting at a multiple of WIDTH)
+	void set_row(int x, int y, simd::vint colours, int laneMask) {
+		simd::store_masked_u32(colour_span(x, y), colours, laneMask);
+	}
+	rgba8_t get(int x, int y) const { return colour_data()[pixel_index(x, y)]; }
+	// The colour image in linear rows (bottom row first in memory), valid until the framebuffer is next changed
+	ImageView image();
+	// the same, gathered into rows (resized to fit) rather than the framebuffer's own buffer
+	ImageView image(std::vector<rgba8_t>& rows);
+	// Writes the colour image to a file in the given format, encoding it on threadPool if given and the format can
+	// use it. Returns false if it could not be encoded or written
+	bool write_image(const char* filename, imageFormat format = TGA, ThreadPool* threadPool = nullptr);
+};
@@ -0,0 +1,494 @@
+#include "imageEncoder.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+namespace {
+	uint8_t red(uint32_t rgba) { return uint8_t(rgba); }
+	uint8_t green(uint32_t rgba) { return uint8_t(rgba >> 8); }
+	uint8_t blue(uint32_t rgba) { return uint8_t(rgba >> 16); }
+
+	void put_u32_be(std::vector<uint8_t>& out, uint32_t value) {
+		uint8_t bytes[4] = { uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value) };
+		out.insert(out.end(), bytes, bytes + 4);
+	}
+
+	// TGA, 24 bit. Rows are written bottom row first, TGA's default origin, so an image stored that way (like a
+	// Framebuffer's) is read in order. RLE runs are found comparing whole 32 bit pixels, and packets never cross rows
+	class TGAEncoder : public ImageEncoder {
+	private:
+		static constexpr int MAX_PACKET = 128; // pixels per RLE packet
+		bool m_rle;
+
+		// Writes the pixel as BGR. It stores 4 bytes (the last of which the next pixel overwrites), so the output
+		// needs a byte of slack at the end
+		static uint8_t* put_pixel(uint8_t* out, uint32_t rgba) {
+			uint32_t bgr = (rgba & 0xFF) << 16 | (rgba & 0xFF00) | (rgba >> 16 & 0xFF);
+			memcpy(out, &bgr, 4);
+			return out + 3;
+		}
+
+		// Encodes one row as RLE packets, returning the end of its output. A run packet is used for 2 or more
+		// equal pixels, everything between runs goes in raw packets
+		static uint8_t* encode_rle_row(uint8_t* out, const uint32_t* row, int width) {
+			int x = 0;
+			while (x < width) {
+				int run = 1;
+				while (x + run < width && run < MAX_PACKET && row[x + run] == row[x]) {
+					run++;
+				}
+				if (run > 1) {
+					*out++ = uint8_t(0x80 | (run - 1));
+					out = put_pixel(out, row[x]);
+					x += run;
+					continue;
+				}
+				// raw pixels up to where the next run starts
+				int end = x + 1;
+				while (end < width && end - x < MAX_PACKET && !(end + 1 < width && row[end] == row[end + 1])) {
+					end++;
+				}
+				*out++ = uint8_t(end - x - 1);
+				for (; x < end; x++) {
+					out = put_pixel(out, row[x]);
+				}
+			}
+			return out;
+		}
+	public:
+		TGAEncoder(bool rle) : m_rle(rle) {}
+
+		bool encode(const ImageView& image, std::vector<uint8_t>& out, ThreadPool*) override {
+			if (image.width > 0xFFFF || image.height > 0xFFFF) {
+				std::cerr << "can't encode a " << image.width << "x" << image.height << " image as tga\n";
+				return false;
+			}
+			// room for the largest the image can encode to (a raw packet header per MAX_PACKET pixels), and
+			// put_pixel's slack
+			size_t maxRow = size_t(image.width) * 3 + (image.width + MAX_PACKET - 1) / MAX_PACKET;
+			out.resize(18 + maxRow * image.height + 1 + 26);
+			// header: no ID or colour map, true colour (RLE or not), 24 bits per pixel, bottom-left origin
+			const uint8_t header[18] = { 0, 0, uint8_t(m_rle ? 10 : 2), 0, 0, 0, 0, 0, 0, 0, 0, 0,
+				uint8_t(image.width), uint8_t(image.width >> 8), uint8_t(image.height), uint8_t(image.height >> 8), 24, 0 };
+			memcpy(out.data(), header, sizeof(header));
+			uint8_t* end = out.data() + sizeof(header);
+			for (int y = image.height - 1; y >= 0; y--) {
+				const uint32_t* row = image.row(y);
+				if (m_rle) {
+					end = encode_rle_row(end, row, image.width);
+				}
+				else {
+					for (int x = 0; x < image.width; x++) {
+						end = put_pixel(end, row[x]);
+					}
+				}
+			}
+			// TGA 2.0 footer, with no developer or extension areas
+			const char footer[26] = { 0, 0, 0, 0, 0, 0, 0, 0, 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.', 0 };
+			memcpy(end, footer, sizeof(footer));
+			out.resize(end + sizeof(footer) - out.data());
+			return true;
+		}
+	};
+
+	class PPMEncoder : public ImageEncoder {
+	public:
+		bool encode(const ImageView& image, std::vector<uint8_t>& out, ThreadPool*) override {
+			std::string header = "P6\n" + std::to_string(image.width) + " " + std::to_string(image.height) + "\n255\n";
+			out.resize(header.size() + size_t(image.width) * image.height * 3);
+			memcpy(out.data(), header.data(), header.size());
+			uint8_t* rgb = out.data() + header.size();
+			for (int y = 0; y < image.height; y++) {
+				const uint32_t* row = image.row(y);
+				for (int x = 0; x < image.width; x++, rgb += 3) {
+					rgb[0] = red(row[x]);
+					rgb[1] = green(row[x]);
+					rgb[2] = blue(row[x]);
+				}
+			}
+			return true;
+		}
+	};
+
+	class RawPlanarEncoder : public ImageEncoder {
+	public:
+		bool encode(const ImageView& image, std::vector<uint8_t>& out, ThreadPool*) override {
+			size_t planeSize = size_t(image.width) * image.height;
+			out.resize(planeSize * 3);
+			uint8_t* r = out.data();
+			uint8_t* g = r + planeSize;
+			uint8_t* b = g + planeSize;
+			for (int y = 0; y < image.height; y++) {
+				const uint32_t* row = image.row(y);
+				for (int x = 0; x < image.width; x++) {
+					*r++ = red(row[x]);
+					*g++ = green(row[x]);
+					*b++ = blue(row[x]);
+				}
+			}
+			return true;
+		}
+	};
+
+	// PNG, 8 bit RGB. Each row is filtered with whichever PNG filter gives the smallest sum of absolute
+	// (signed) bytes, as stb_image_write does, and deflated with stb_image_write's compressor. With a thread pool,
+	// the image is split into bands of rows, each filtered and compressed by its own task. stb can only produce a
+	// complete zlib stream, so the bands' streams are then joined into one: each band's final block flag is
+	// cleared, an empty stored block is appended to byte align its end (as zlib's sync flush does), and the bands'
+	// Adler-32 checksums are combined. Bands only lose matches reaching back into the previous band, which costs
+	// little compression for bands of many rows
+	class PNGEncoder : public ImageEncoder {
+	private:
+		static constexpr int MIN_BAND_ROWS = 32;
+
+		struct Band {
+			int firstRow, rows;
+			bool last;
+			std::vector<uint8_t> filtered;
+			std::vector<uint8_t> blocks; // the band's deflate blocks (no zlib header or checksum), joinable unless last
+			uint32_t adler;
+			bool ok;
+		};
+
+		static void to_rgb(const uint32_t* row, int width, uint8_t* rgb) {
+			for (int x = 0; x < width; x++, rgb += 3) {
+				rgb[0] = red(row[x]);
+				rgb[1] = green(row[x]);
+				rgb[2] = blue(row[x]);
+			}
+		}
+
+		static int paeth(int a, int b, int c) {
+			int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+			return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+		}
+
+		// Filters a row with one filter type into line, returning the sum of the filtered bytes as signed values
+		template <int TYPE>
+		static int filter_with(const uint8_t* row, const uint8_t* above, int bytes, uint8_t* line) {
+			int sum = 0;
+			for (int i = 0; i < bytes; i++) {
+				int left = i >= 3 ? row[i - 3] : 0, up = above[i], upLeft = i >= 3 ? above[i - 3] : 0;
+				int predicted = TYPE == 0 ? 0 : TYPE == 1 ? left : TYPE == 2 ? up : TYPE == 3 ? (left + up) >> 1 : paeth(left, up, upLeft);
+				line[i] = uint8_t(row[i] - predicted);
+				sum += std::abs(int(int8_t(line[i])));
+			}
+			return sum;
+		}
+
+		// Filters row (given the row above it, all zero for the top row) into out, filter type byte first
+		static void filter_row(const uint8_t* row, const uint8_t* above, int bytes, uint8_t* out, uint8_t* scratch) {
+			static int (*const filters[5])(const uint8_t*, const uint8_t*, int, uint8_t*) = {
+				filter_with<0>, filter_with<1>, filter_with<2>, filter_with<3>, filter_with<4>
+			};
+			out[0] = 0;
+			int bestSum = filters[0](row, above, bytes, out + 1);
+			for (int type = 1; type < 5; type++) {
+				int sum = filters[type](row, above, bytes, scratch);
+				if (sum < bestSum) {
+					bestSum = sum;
+					out[0] = uint8_t(type);
+					memcpy(out + 1, scratch, bytes);
+				}
+			}
+		}
+
+		// Bit position just after the end-of-block code of the single fixed Huffman block stb writes, found by
+		// walking its codes. Huffman codes are read through a table indexed by the next 9 bits of the stream
+		static size_t fixed_block_end(const uint8_t* data, size_t size) {
+			static const unsigned char LENGTH_EXTRA[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+			static const unsigned char DISTANCE_EXTRA[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+			struct Code { uint16_t symbol; uint8_t bits; };
+			static const std::vector<Code> table = [] {
+				std::vector<Code> codes(512);
+				auto add = [&](int firstSymbol, int lastSymbol, int firstCode, int bits) {
+					for (int symbol = firstSymbol; symbol <= lastSymbol; symbol++) {
+						int code = firstCode + symbol - firstSymbol, reversed = 0;
+						for (int i = 0; i < bits; i++) {
+							reversed |= ((code >> i) & 1) << (bits - 1 - i);
+						}
+						for (int high = 0; high < 512; high += 1 << bits) {
+							codes[reversed | high] = { uint16_t(symbol), uint8_t(bits) };
+						}
+					}
+				};
+				add(0, 143, 0x30, 8);
+				add(144, 255, 0x190, 9);
+				add(256, 279, 0, 7);
+				add(280, 287, 0xC0, 8);
+				return codes;
+			}();
+			auto peek = [&](size_t bit) {
+				uint32_t bits = 0;
+				for (size_t i = bit >> 3, shift = 0; i < size && shift < 32; i++, shift += 8) {
+					bits |= uint32_t(data[i]) << shift;
+				}
+				return bits >> (bit & 7);
+			};
+			auto reverse5 = [](uint32_t code) {
+				return (code & 1) << 4 | (code & 2) << 2 | (code & 4) | (code & 8) >> 2 | (code & 16) >> 4;
+			};
+
+			size_t bit = 16 + 3; // past the zlib header and the block header
+			for (;;) {
+				uint32_t bits = peek(bit);
+				Code code = table[bits & 511];
+				bit += code.bits;
+				if (code.symbol == 256) {
+					return bit;
+				}
+				if (code.symbol > 256) {
+					bit += LENGTH_EXTRA[code.symbol - 257];
+					int distance = int(reverse5(peek(bit) & 31));
+					bit += 5 + DISTANCE_EXTRA[distance];
+				}
+			}
+		}
+
+		// Makes the zlib stream stb produced for a band into deflate blocks that another band's can follow
+		static void make_joinable(const uint8_t* stream, int size, std::vector<uint8_t>& out) {
+			const uint8_t* blocks = stream + 2; // past the zlib header
+			size_t blocksSize = size - 2 - 4; // less the checksum
+			if ((blocks[0] >> 1 & 3) == 0) {
+				// stb fell back to stored blocks, which are byte aligned. Clear the last one's final flag
+				out.assign(blocks, blocks + blocksSize);
+				size_t pos = 0;
+				while (!(out[pos] & 1)) {
+					pos += 5 + (out[pos + 1] | out[pos + 2] << 8);
+				}
+				out[pos] &= ~1;
+				return;
+			}
+			size_t end = fixed_block_end(stream, size) - 16;
+			out.assign(blocks, blocks + (end + 7) / 8);
+			out[0] &= ~1;
+			// an empty stored block: 3 header bits (in the padding after the end of block code if they fit),
+			// padding to a byte boundary, then LEN = 0 and NLEN = 0xFFFF
+			if ((end & 7) == 0 || (end & 7) > 5) {
+				out.push_back(0);
+			}
+			const uint8_t emptyStored[4] = { 0, 0, 0xFF, 0xFF };
+			out.insert(out.end(), emptyStored, emptyStored + 4);
+		}
+
+		// Adler-32 of the data whose two parts have checksums a and b, the second part being bLength bytes
+		static uint32_t combine_adler(uint32_t a, uint32_t b, size_t bLength) {
+			const uint32_t MOD = 65521;
+			uint32_t a1 = a & 0xFFFF, a2 = a >> 16, b1 = b & 0xFFFF, b2 = b >> 16;
+			uint32_t s1 = (a1 + b1 + MOD - 1) % MOD;
+			uint32_t s2 = uint32_t((a2 + b2 + (bLength % MOD) * uint64_t(a1 + MOD - 1)) % MOD);
+			return s2 << 16 | s1;
+		}
+
+		static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+			static const std::vector<uint32_t> table = [] {
+				std::vector<uint32_t> t(256);
+				for (uint32_t i = 0; i < 256; i++) {
+					uint32_t c = i;
+					for (int k = 0; k < 8; k++) {
+						c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					}
+					t[i] = c;
+				}
+				return t;
+			}();
+			crc = ~crc;
+			for (size_t i = 0; i < size; i++) {
+				crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			}
+			return ~crc;
+		}
+
+		static void put_chunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size) {
+			put_u32_be(out, uint32_t(size));
+			size_t start = out.size();
+			out.insert(out.end(), type, type + 4);
+			out.insert(out.end(), data, data + size);
+			put_u32_be(out, crc32(out.data() + start, out.size() - start));
+		}
+
+		static void encode_band(const ImageView& image, Band& band) {
+			int bytes = image.width * 3;
+			std::vector<uint8_t> above(bytes, 0), row(bytes), scratch(bytes);
+			if (band.firstRow > 0) {
+				to_rgb(image.row(band.firstRow - 1), image.width, above.data());
+			}
+			band.filtered.resize(size_t(band.rows) * (bytes + 1));
+			for (int i = 0; i < band.rows; i++) {
+				to_rgb(image.row(band.firstRow + i), image.width, row.data());
+				filter_row(row.data(), above.data(), bytes, band.filtered.data() + size_t(i) * (bytes + 1), scratch.data());
+				std::swap(row, above);
+			}
+
+			int size = 0;
+			unsigned char* stream = stbi_zlib_compress(band.filtered.data(), int(band.filtered.size()), &size, stbi_write_png_compression_level);
+			band.ok = stream != nullptr;
+			if (!band.ok) return;
+			band.adler = uint32_t(stream[size - 4]) << 24 | stream[size - 3] << 16 | stream[size - 2] << 8 | stream[size - 1];
+			if (band.last) {
+				band.blocks.assign(stream + 2, stream + size - 4);
+			}
+			else {
+				make_joinable(stream, size, band.blocks);
+			}
+			STBIW_FREE(stream);
+		}
+	public:
+		bool encode(const ImageView& image, std::vector<uint8_t>& out, ThreadPool* threadPool) override {
+			if (size_t(image.width) * 3 + 1 > size_t(INT32_MAX) / std::max(image.height, 1)) {
+				std::cerr << "can't encode a " << image.width << "x" << image.height << " image as png\n";
+				return false;
+			}
+			int bandCount = 1;
+			if (threadPool) {
+				bandCount = std::clamp(image.height / MIN_BAND_ROWS, 1, threadPool->size() * 2);
+			}
+			std::vector<Band> bands(bandCount);
+			for (int i = 0; i < bandCount; i++) {
+				bands[i].firstRow = int(int64_t(image.height) * i / bandCount);
+				bands[i].rows = int(int64_t(image.height) * (i + 1) / bandCount) - bands[i].firstRow;
+				bands[i].last = i == bandCount - 1;
+			}
+			auto encodeBand = [&](int i) { encode_band(image, bands[i]); };
+			if (threadPool) {
+				threadPool->parallel_for(bandCount, encodeBand);
+			}
+			else {
+				encodeBand(0);
+			}
+
+			// zlib stream: header, the bands' blocks, checksum
+			std::vector<uint8_t> zlib = { 0x78, 0x5e };
+			uint32_t adler = 1;
+			for (int i = 0; i < bandCount; i++) {
+				if (!bands[i].ok) {
+					std::cerr << "can't compress png data\n";
+					return false;
+				}
+				zlib.insert(zlib.end(), bands[i].blocks.begin(), bands[i].blocks.end());
+				adler = i == 0 ? bands[i].adler : combine_adler(adler, bands[i].adler, size_t(bands[i].rows) * (image.width * 3 + 1));
+			}
+			put_u32_be(zlib, adler);
+
+			out.clear();
+			const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			out.insert(out.end(), signature, signature + 8);
+			uint8_t header[13] = { 0 };
+			for (int i = 0; i < 4; i++) {
+				header[i] = uint8_t(uint32_t(image.width) >> (24 - 8 * i));
+				header[4 + i] = uint8_t(uint32_t(image.height) >> (24 - 8 * i));
+			}
+			header[8] = 8; // bits per channel
+			header[9] = 2; // RGB
+			put_chunk(out, "IHDR", header, sizeof(header));
+			put_chunk(out, "IDAT", zlib.data(), zlib.size());
+			put_chunk(out, "IEND", nullptr, 0);
+			return true;
+		}
+	};
+
+	// QOI (see qoiformat.org), 3 channels. Pixels are compared and hashed as whole 32 bit values, alpha always
+	// being 255
+	class QOIEncoder : public ImageEncoder {
+	public:
+		bool encode(const ImageView& image, std::vector<uint8_t>& out, ThreadPool*) override {
+			// worst case 4 bytes per pixel (QOI_OP_RGB), plus header and end marker
+			out.resize(14 + size_t(image.width) * image.height * 4 + 8);
+			uint8_t* p = out.data();
+			const uint8_t header[14] = { 'q', 'o', 'i', 'f',
+				uint8_t(image.width >> 24), uint8_t(image.width >> 16), uint8_t(image.width >> 8), uint8_t(image.width),
+				uint8_t(image.height >> 24), uint8_t(image.height >> 16), uint8_t(image.height >> 8), uint8_t(image.height),
+				3, 0 };
+			memcpy(p, header, sizeof(header));
+			p += sizeof(header);
+
+			uint32_t index[64] = { 0 };
+			uint32_t previous = 0xFF000000u; // black, opaque
+			int run = 0;
+			for (int y = 0; y < image.height; y++) {
+				const uint32_t* row = image.row(y);
+				for (int x = 0; x < image.width; x++) {
+					uint32_t pixel = row[x] | 0xFF000000u;
+					if (pixel == previous) {
+						if (++run == 62) {
+							*p++ = uint8_t(0xC0 | (run - 1)); // QOI_OP_RUN
+							run = 0;
+						}
+						continue;
+					}
+					if (run > 0) {
+						*p++ = uint8_t(0xC0 | (run - 1));
+						run = 0;
+					}
+					int hash = (red(pixel) * 3 + green(pixel) * 5 + blue(pixel) * 7 + 255 * 11) % 64;
+					if (index[hash] == pixel) {
+						*p++ = uint8_t(hash); // QOI_OP_INDEX
+					}
+					else {
+						index[hash] = pixel;
+						int8_t dr = int8_t(red(pixel) - red(previous));
+						int8_t dg = int8_t(green(pixel) - green(previous));
+						int8_t db = int8_t(blue(pixel) - blue(previous));
+						int8_t drg = int8_t(dr - dg), dbg = int8_t(db - dg);
+						if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+							*p++ = uint8_t(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)); // QOI_OP_DIFF
+						}
+						else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+							*p++ = uint8_t(0x80 | (dg + 32)); // QOI_OP_LUMA
+							*p++ = uint8_t((drg + 8) << 4 | (dbg + 8));
+						}
+						else {
+							*p++ = 0xFE; // QOI_OP_RGB
+							*p++ = red(pixel);
+							*p++ = green(pixel);
+							*p++ = blue(pixel);
+						}
+					}
+					previous = pixel;
+				}
+			}
+			if (run > 0) {
+				*p++ = uint8_t(0xC0 | (run - 1));
+			}
+			const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+			memcpy(p, end, sizeof(end));
+			out.resize(p + sizeof(end) - out.data());
+			return true;
+		}
+	};
+}
+
+std::unique_ptr<ImageEncoder> make_image_encoder(imageFormat format)
+{
+	switch (format) {
+	case TGA: return std::make_unique<TGAEncoder>(true);
+	case TGA_RAW: return std::make_unique<TGAEncoder>(false);
+	case PPM: return std::make_unique<PPMEncoder>();
+	case RAW_PLANAR: return std::make_unique<RawPlanarEncoder>();
+	case PNG: return std::make_unique<PNGEncoder>();
+	case QOI: return std::make_unique<QOIEncoder>();
+	}
+	return nullptr;
+}
+
+bool write_file(const char* filename, const std::vector<uint8_t>& data)
+{
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	file.write((const char*)data.data(), data.size());
+	if (!file.good()) {
+		std::cerr << "can't write file " << filename << "\n";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+class ThreadPool;
+
+// Image file formats a frame can be written in, trading file size against encode time
+enum imageFormat {
+	TGA, // run length encoded TGA
+	TGA_RAW, // uncompressed TGA
+	PPM, // binary PPM (P6), uncompressed
+	RAW_PLANAR, // no header, the red plane then the green plane then the blue plane, each top row first
+	PNG, // filtered and deflated with stb_image_write, in row bands in parallel
+	QOI // "Quite OK Image" format, fast lossless compression
+};
+// number of imageFormats, e.g. for a table of encoders indexed by format
+constexpr int IMAGE_FORMATS = QOI + 1;
+
+// A read-only view of an image of 8 bit RGBA pixels (R in the lowest byte, as rgba8_t). Rows are numbered from the
+// top of the image, but may be stored in either order
+struct ImageView {
+	const uint32_t* top; // first pixel of the top row
+	ptrdiff_t stride; // pixels from one row to the one below it, negative if stored bottom row first
+	int width, height;
+
+	const uint32_t* row(int y) const { return top + y * stride; }
+};
+
+// Encodes images into a file format in memory. Alpha is not written, as frames are opaque
+class ImageEncoder {
+public:
+	virtual ~ImageEncoder() = default;
+	// Replaces the contents of out with the encoded image. If threadPool is given, encoders that can split up
+	// their work may use it (so encode must not be called from one of its tasks). Returns false (having printed
+	// why) if the image cannot be stored in the format
+	virtual bool encode(const ImageView& image, std::vector<uint8_t>& out, ThreadPool* threadPool = nullptr) = 0;
+};
+
+std::unique_ptr<ImageEncoder> make_image_encoder(imageFormat format);
+
+// Writes data to a file with a single write, returning false (having printed why) on failure
+bool write_file(const char* filename, const std::vector<uint8_t>& data);
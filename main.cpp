@@ -4,7 +4,7 @@
 int main(int argc, char** argv) {
 	if (argc < 2) {
 		std::cout << "Please input which example you wish to run" << std::endl;
-		std::cout << "Available examples: basic_example, cherkerboard_example, model_example" << std::endl;
+		std::cout << "Available examples: basic_example, cherkerboard_example, model_example, model_benchmark, model_orbit" << std::endl;
 		return -1;
 	}
 	if (strcmp("basic_example", argv[1]) == 0) {
@@ -29,6 +29,24 @@ int main(int argc, char** argv) {
 			return CheckerboardExample::run(argv[2]);
 		}
 	}
+	if (strcmp("model_benchmark", argv[1]) == 0) {
+		std::cout << "Executing model_benchmark" << std::endl;
+		if (argc < 3) {
+			return ModelExample::benchmark();
+		}
+		else {
+			return ModelExample::benchmark(atoi(argv[2]));
+		}
+	}
+	if (strcmp("model_orbit", argv[1]) == 0) {
+		std::cout << "Executing model_orbit" << std::endl;
+		if (argc < 3) {
+			return ModelExample::orbit();
+		}
+		else {
+			return ModelExample::orbit(atoi(argv[2]));
+		}
+	}
 	if (strcmp("model_example", argv[1]) == 0) {
 		std::cout << "Executing model_example" << std::endl;
 		return ModelExample::run();
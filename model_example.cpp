@@ -3,10 +3,13 @@
 #include "sampler.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <iostream>
+#include <chrono>
+#include <string>
 
 // A more complex example which performs blinn-phong shading alongside diffuse, normal and AO mapping on a given model
 
@@ -26,7 +29,9 @@ namespace ModelExample {
 		glm::vec3 worldPos_tangent; // for normal mapped lighting
 	};
 
-	struct SkullProgram : public IShaderProgram<Vertex, Varying> {
+	// final, so that when drawn as a SkullProgram (rather than through IShaderProgram) the renderer's calls to
+	// the shader functions are resolved at compile time
+	struct SkullProgram final : public IShaderProgram<Vertex, Varying> {
 
 		glm::mat4 m_model;
 		glm::mat4 m_view;
@@ -47,10 +52,11 @@ namespace ModelExample {
 			m_view(view),
 			m_projection(projection),
 			m_camPos(camPos),
-			m_diffuseSampler(diffusePath, BILINEAR, CLAMPTOEDGE),
-			m_normalSampler(normalPath, BILINEAR, CLAMPTOEDGE),
-			m_specularSampler(specularPath, BILINEAR, CLAMPTOEDGE),
-			m_AOSampler(AOPath, BILINEAR, CLAMPTOEDGE),
+			m_diffuseSampler(diffusePath, TRILINEAR, CLAMPTOEDGE),
+			m_normalSampler(normalPath, TRILINEAR, CLAMPTOEDGE),
+			// roughness and AO maps are greyscale, so are stored and sampled as a single channel
+			m_specularSampler(specularPath, TRILINEAR, CLAMPTOEDGE, R8),
+			m_AOSampler(AOPath, TRILINEAR, CLAMPTOEDGE, R8),
 			m_normalMatrix(glm::transpose(glm::inverse(model)))
 		{}
 
@@ -86,43 +92,89 @@ namespace ModelExample {
 			float spec = std::pow(std::max(glm::dot(norm, H), 0.0f), 16.0f) * 0.5f;
 
 			return (diff * m_diffuseSampler(fragIn.texCoords.x, fragIn.texCoords.y)
-				+ spec * (glm::vec3(1.0) - m_specularSampler(fragIn.texCoords.x, fragIn.texCoords.y)))
-				* m_AOSampler(fragIn.texCoords.x, fragIn.texCoords.y);
+				+ spec * (1.f - m_specularSampler.sample<1>(fragIn.texCoords.x, fragIn.texCoords.y).x))
+				* m_AOSampler.sample<1>(fragIn.texCoords.x, fragIn.texCoords.y).x;
 			//return m_specularSampler(fragIn.texCoords.x, fragIn.texCoords.y);
 		}
 
-		virtual Varying interpolate(const Varying& a, const Varying& b, const Varying& c, float ba, float bb, float bc) {
-			Varying ret{};
-			ret.texCoords = ba * a.texCoords + bb * b.texCoords + bc * c.texCoords;
-			ret.camPos_tangent = ba * a.camPos_tangent + bb * b.camPos_tangent + bc * c.camPos_tangent;
-			ret.lightDir_tangent = ba * a.lightDir_tangent + bb * b.lightDir_tangent + bc * c.lightDir_tangent;
-			ret.worldPos_tangent = ba * a.worldPos_tangent + bb * b.worldPos_tangent + bc * c.worldPos_tangent;
-			return ret;
+		// Same shading as above for a batch of fragments, used by the renderer when drawing a SkullProgram directly.
+		// Each texture is sampled for the whole batch at once (with the texture coordinate derivatives choosing mip
+		// levels, which the single fragment version has no way to), then the lighting maths runs across all lanes in
+		// each statement
+		template <int Width>
+		void fragmentShader(const FragmentBatch<Varying, Width>& in, ColourBatch<Width>& out) {
+			constexpr int UV = VARYING_ATTRIBUTE(Varying, texCoords);
+			constexpr int CAM = VARYING_ATTRIBUTE(Varying, camPos_tangent);
+			constexpr int LIGHT = VARYING_ATTRIBUTE(Varying, lightDir_tangent);
+			constexpr int WORLD = VARYING_ATTRIBUTE(Varying, worldPos_tangent);
+
+			const float* u = in.attributes[UV];
+			const float* v = in.attributes[UV + 1];
+			const float* dx[2] = { in.dFdx[UV], in.dFdx[UV + 1] };
+			const float* dy[2] = { in.dFdy[UV], in.dFdy[UV + 1] };
+			float normal[3][Width], diffuse[3][Width], specular[1][Width], AO[1][Width];
+			m_normalSampler.sample(u, v, dx[0], dx[1], dy[0], dy[1], normal);
+			m_diffuseSampler.sample(u, v, dx[0], dx[1], dy[0], dy[1], diffuse);
+			m_specularSampler.sample(u, v, dx[0], dx[1], dy[0], dy[1], specular);
+			m_AOSampler.sample(u, v, dx[0], dx[1], dy[0], dy[1], AO);
+
+			for (int lane = 0; lane < Width; lane++) {
+				// Blinn-Phong shading
+				float x = normal[0][lane] * 2.f - 1.f, y = normal[1][lane] * 2.f - 1.f, z = normal[2][lane] * 2.f - 1.f;
+				float invLen = 1.f / std::sqrt(x * x + y * y + z * z);
+				x *= invLen; y *= invLen; z *= invLen;
+
+				// Diffuse
+				float lx = in.attributes[LIGHT][lane], ly = in.attributes[LIGHT + 1][lane], lz = in.attributes[LIGHT + 2][lane];
+				float diff = std::max(lx * x + ly * y + lz * z, 0.f);
+
+				// Specular
+				float vx = in.attributes[CAM][lane] - in.attributes[WORLD][lane];
+				float vy = in.attributes[CAM + 1][lane] - in.attributes[WORLD + 1][lane];
+				float vz = in.attributes[CAM + 2][lane] - in.attributes[WORLD + 2][lane];
+				float invViewLen = 1.f / std::sqrt(vx * vx + vy * vy + vz * vz);
+				float hx = vx * invViewLen + lx, hy = vy * invViewLen + ly, hz = vz * invViewLen + lz;
+				float invHLen = 1.f / std::sqrt(hx * hx + hy * hy + hz * hz);
+				float spec = std::max((x * hx + y * hy + z * hz) * invHLen, 0.f);
+				spec *= spec; spec *= spec; spec *= spec; spec *= spec; // ^16
+				spec *= 0.5f;
+
+				float specularTerm = spec * (1.f - specular[0][lane]);
+				out.r[lane] = (diff * diffuse[0][lane] + specularTerm) * AO[0][lane];
+				out.g[lane] = (diff * diffuse[1][lane] + specularTerm) * AO[0][lane];
+				out.b[lane] = (diff * diffuse[2][lane] + specularTerm) * AO[0][lane];
+			}
 		}
 	};
 
-	int run() {
-		int width = 1920;
-		int height = 1080;
+	const int width = 1920;
+	const int height = 1080;
+
+	// Just the per fragment shading of a SkullProgram, as a type of its own (without the batched shader), so that it
+	// can be timed with static dispatch against the same shading through IShaderProgram
+	struct SkullFragmentProgram {
+		SkullProgram& program;
+		Varying vertexShader(const Vertex& input) { return program.vertexShader(input); }
+		glm::vec3 fragmentShader(const Varying& fragIn) { return program.fragmentShader(fragIn); }
+	};
 
+	SkullProgram makeProgram() {
 		glm::mat4 model = glm::scale(glm::mat4(1.f), glm::vec3(0.5f));
 		glm::vec3 camPos = glm::vec3(0, 10, 20);
 		glm::mat4 view = glm::lookAt(camPos, glm::vec3(0.0, 2.5, 0.0), glm::vec3(0.0, 1.0, 0.0));
 		glm::mat4 projection = glm::perspective(glm::radians(60.f), (float)width / height, 0.1f, 100.0f);
 
-		SkullProgram program(
+		return SkullProgram(
 			model, view, projection, camPos,
 			"Resources/demon-skull/textures/DemonSkull_Diffuse.png",
 			"Resources/demon-skull/textures/DemonSkull_Normal.png",
 			"Resources/demon-skull/textures/DemonSkull_Roughness.png",
 			"Resources/demon-skull/textures/DemonSkull_AO.png"
 		);
-		Renderer<Vertex, Varying> renderer(width, height);
-
-		// set up vertex buffer and index buffer (using ASSIMP)
-		std::vector<Vertex> vertices;
-		std::vector<int> indices;
+	}
 
+	// set up vertex buffer and index buffer (using ASSIMP), returns false if the model fails to load
+	bool loadModel(std::vector<Vertex>& vertices, std::vector<int>& indices) {
 		//load .obj model file into Assimp's scene object, from which we then extract the necessary data we need
 		Assimp::Importer importer;
 		const aiScene* aScene = importer.ReadFile("Resources/demon-skull/source/DemonSkull_Optimized2.fbx",
@@ -133,7 +185,7 @@ namespace ModelExample {
 			aiProcess_CalcTangentSpace); // compute tangent vectors for the loaded vertices
 		if (!aScene || aScene->mFlags && AI_SCENE_FLAGS_INCOMPLETE || !aScene->mRootNode) {
 			std::cout << "Error loading scene: " << importer.GetErrorString() << std::endl;
-			return -5;
+			return false;
 		}
 
 		// Reserve necessary space for the vertex and index vectors
@@ -180,7 +232,99 @@ namespace ModelExample {
 			}
 		}
 
-		renderer.draw(program, vertices, indices, "Output/model_example.tga");
+		return true;
+	}
+
+	int run() {
+		SkullProgram program = makeProgram();
+		Renderer<Vertex, Varying> renderer(width, height);
+		renderer.setRenderMode(BINNED);
+
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		if (!loadModel(vertices, indices)) {
+			return -5;
+		}
+
+		renderer.beginFrame();
+		renderer.draw(program, vertices, indices);
+		renderer.endFrame();
+		renderer.present("Output/model_example.tga");
+
+		return 0;
+	}
+
+	// Draws the model frames times in each configuration and prints the average time per frame of each. The first
+	// two shade each fragment alone, sampling only the base level of each texture, once through the virtual
+	// IShaderProgram interface and once statically dispatched, so they differ only in the calls. The rest draw the
+	// concrete SkullProgram type, which shades fragments in batches and samples trilinearly, so they do more
+	// texture work per fragment (and give a different image), in each shading mode. One renderer is used for all
+	// frames of a configuration, as it would be in a frame loop, and the image is only written once timing is done
+	int benchmark(int frames) {
+		SkullProgram program = makeProgram();
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		if (!loadModel(vertices, indices)) {
+			return -5;
+		}
+
+		auto timeFrames = [&](auto& shaderProgram, shadingMode mode) {
+			Renderer<Vertex, Varying> renderer(width, height);
+			renderer.setRenderMode(BINNED);
+			renderer.setShadingMode(mode);
+			double totalMs = 0.0;
+			for (int i = 0; i < frames; i++) {
+				auto start = std::chrono::steady_clock::now();
+				renderer.beginFrame();
+				renderer.clear();
+				renderer.draw(shaderProgram, vertices, indices);
+				renderer.endFrame();
+				totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+			renderer.present("Output/model_benchmark.tga");
+			return totalMs / frames;
+		};
+		IShaderProgram<Vertex, Varying>& virtualProgram = program;
+		SkullFragmentProgram fragmentProgram{ program };
+		std::cout << "Virtual dispatch, per fragment base level: " << timeFrames(virtualProgram, FORWARD) << " ms per frame" << std::endl;
+		std::cout << "Static dispatch, per fragment base level: " << timeFrames(fragmentProgram, FORWARD) << " ms per frame" << std::endl;
+		std::cout << "Static dispatch, batched trilinear: " << timeFrames(program, FORWARD) << " ms per frame" << std::endl;
+		std::cout << "Static dispatch, batched trilinear, depth prepass: " << timeFrames(program, DEPTH_PREPASS) << " ms per frame" << std::endl;
+		std::cout << "Static dispatch, batched trilinear, visibility buffer: " << timeFrames(program, VISIBILITY_BUFFER) << " ms per frame" << std::endl;
+
+		return 0;
+	}
+
+	// Renders frames with the camera orbiting the model, writing each to its own file with asynchronous presents, so
+	// each frame is encoded and written while the next ones are rendered. Prints the average time per frame
+	int orbit(int frames) {
+		SkullProgram program = makeProgram();
+		std::vector<Vertex> vertices;
+		std::vector<int> indices;
+		if (!loadModel(vertices, indices)) {
+			return -5;
+		}
+
+		Renderer<Vertex, Varying> renderer(width, height);
+		renderer.setRenderMode(BINNED);
+		renderer.setPresentMode(ASYNCHRONOUS);
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++) {
+			float angle = glm::two_pi<float>() * i / frames;
+			program.m_camPos = glm::vec3(20.f * std::sin(angle), 10.f, 20.f * std::cos(angle));
+			program.m_view = glm::lookAt(program.m_camPos, glm::vec3(0.0, 2.5, 0.0), glm::vec3(0.0, 1.0, 0.0));
+			renderer.beginFrame();
+			renderer.clear();
+			renderer.draw(program, vertices, indices);
+			renderer.endFrame();
+			std::string filename = "Output/model_orbit_" + std::to_string(i) + ".tga";
+			renderer.present(filename.c_str());
+		}
+		if (!renderer.finishPresents()) {
+			return -6;
+		}
+		double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Orbit: " << totalMs / std::max(frames, 1) << " ms per frame, including writing" << std::endl;
 
 		return 0;
 	}
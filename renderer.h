@@ -1,130 +1,701 @@
 #pragma once
-#include "External/tgaimage.h"
+#include "framebuffer.h"
 #include "shaderProgram.h"
+#include "simd.h"
+#include "threadPool.h"
+#include "frameWriter.h"
 #include <vector>
+#include <memory>
+#include <deque>
+#include <bit>
+#include <climits>
+#include <type_traits>
+#include <algorithm>
 
-// 28.4 fixed point subpixel precision, hence values scaled by 2^4=16
+// Default subpixel precision, 28.4 fixed point (i.e. values scaled by 2^4=16). Each Renderer can be given its own
+// precision of 1 to MAX_PRECISION_BITS bits at construction
 #define PRECISION_BITS 4
-constexpr int PRECISION = 1 << PRECISION_BITS;
-constexpr int HALF = 1 << PRECISION_BITS - 1;
+constexpr int MAX_PRECISION_BITS = 8;
 
 //#define DISABLE_PERSPECTIVE_CORRECTION
 
-typedef uint16_t zbuffer_t;
-constexpr auto ZBUFFMAX = std::numeric_limits<zbuffer_t>::max();
+// (block and tile sizes are defined along with the Framebuffer, whose buffers are laid out in them)
+static_assert(BLOCK_SIZE % simd::WIDTH == 0, "block rows must split into whole SIMD registers");
+
+// SERIAL rasterizes every triangle in submission order on the calling thread. BINNED first sorts triangles
+// into screen tiles (keeping submission order within each tile) and then rasterizes the tiles in parallel,
+// producing output identical to SERIAL. In BINNED mode the shader program's fragmentShader (and any interpolate)
+// are called concurrently from several threads, so must not modify shared state
+enum renderMode {SERIAL, BINNED};
+
+// FORWARD shades every fragment that passes the depth test when it is rasterized, so overlapping triangles drawn
+// back to front get shaded several times per pixel. The other two modes cost extra raster work to save shading:
+// DEPTH_PREPASS first rasterizes every triangle writing only depth, then again shading only fragments whose depth
+// equals the stored one. Where several triangles cover a pixel at exactly that depth (coplanar triangles, and for
+// now the shared edges of adjacent ones, as there is no top-left rule yet) each is shaded and the last one drawn
+// wins, rather than the first as with FORWARD. VISIBILITY_BUFFER rasterizes once, storing depth and the ID of the
+// nearest triangle per pixel, then shades each covered pixel exactly once from that triangle's setup, giving the
+// same image as FORWARD (up to float rounding)
+enum shadingMode {FORWARD, DEPTH_PREPASS, VISIBILITY_BUFFER};
+
+// SYNCHRONOUS presents write the frame out before returning. ASYNCHRONOUS presents only copy the frame into a
+// FrameWriter buffer and return, leaving it to be encoded and written on background threads while the next frames
+// are rendered, which hides the cost of writing out a sequence of frames (as long as encoding keeps up)
+enum presentMode {SYNCHRONOUS, ASYNCHRONOUS};
+
+// What a raster pass does with the fragments it covers, see shadingMode
+enum rasterPass {RASTER_SHADE, RASTER_DEPTH, RASTER_DEPTH_EQUAL, RASTER_VISIBILITY};
+
+// Clip codes, one bit per plane a clip space vertex lies outside of. The first six are the view frustum, used to
+// trivially reject triangles entirely outside it. Only the near and far planes and the guard band (a larger region
+// in x/y) ever need triangles to be geometrically clipped: parts of a triangle outside the frustum but inside the
+// guard band are never visited anyway, as bounding boxes are clamped to the image during setup
+constexpr uint16_t CLIP_LEFT = 1 << 0, CLIP_RIGHT = 1 << 1, CLIP_BOTTOM = 1 << 2, CLIP_TOP = 1 << 3;
+constexpr uint16_t CLIP_NEAR = 1 << 4, CLIP_FAR = 1 << 5;
+constexpr uint16_t CLIP_GB_LEFT = 1 << 6, CLIP_GB_RIGHT = 1 << 7, CLIP_GB_BOTTOM = 1 << 8, CLIP_GB_TOP = 1 << 9;
+constexpr uint16_t CLIP_FRUSTUM = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR;
+constexpr uint16_t CLIP_REQUIRED = CLIP_NEAR | CLIP_FAR | CLIP_GB_LEFT | CLIP_GB_RIGHT | CLIP_GB_BOTTOM | CLIP_GB_TOP;
 
 struct ipoint2d {
 	int x, y;
 };
 
+// Edge function in incremental form: its value at the first pixel center of the (block aligned) bounding box,
+// and the (constant) change in value when stepping one whole pixel in x or y. Since the edge function is linear
+// in screen space, the raster loop never has to evaluate it from scratch after triangle setup. EdgeT is int
+// whenever the viewport and subpixel precision allow it, otherwise int64_t (see Renderer::m_wideEdges)
+template <typename EdgeT>
+struct EdgeEquation {
+	EdgeT origin;
+	EdgeT stepX, stepY;
+	// offsets from a block's first pixel to its corner pixels with the lowest/highest edge value, so a
+	// whole block can be classified against the edge with just two additions
+	EdgeT blockMinOffset, blockMaxOffset;
+};
+
+// Same idea for any attribute that is linear in screen space (here z and 1/w)
+struct PlaneEquation {
+	float origin;
+	float stepX, stepY;
+};
+
+// Everything about a triangle that stays constant across its pixels, computed once in triangle setup
+template <typename Varying, typename EdgeT>
+struct TriangleSetup {
+	const Varying* a;
+	const Varying* b;
+	const Varying* c;
+	ipoint2d bbMin, bbMax; // inclusive pixel bounds, already clipped to the image
+	ipoint2d origin; // bbMin rounded down to the block grid, the pixel all equations are relative to
+	EdgeEquation<EdgeT> wa, wb, wc; // edges opposite a, b and c, i.e. unnormalised barycentrics of a, b and c
+	PlaneEquation z, invW;
+	float normFactor; // 1 / (2x triangle area), normalises edge function values to barycentrics
+	int zMin, zMax; // bounds on the triangle's fixed point depth values, for hierarchical z (see Framebuffer::m_blockMaxZ)
+	uint32_t id; // index into the draw call's list of triangles (VISIBILITY_BUFFER only)
+};
+
+// Fragments are shaded in 2x2 quads (see FragmentQuad), so a SIMD row of them is only shaded once the other row
+// of its quads is known too. This is such a pair of rows, y and y + 1 for even y, from x0: the lanes of each row
+// that survived rasterization, and the edge, z and 1/w values at each row's first pixel. A row outside the
+// triangle's rectangle has no fragments, but still has its values for helper fragments
+template <typename EdgeT>
+struct QuadRow {
+	int x0, y;
+	int mask[2];
+	EdgeT wa[2], wb[2], wc[2];
+	float z[2], invW[2];
+};
+
 template <typename Vertex, typename Varying>
 class Renderer {
-	TGAImage m_image;
+	Framebuffer m_framebuffer;
 	int m_width, m_height;
-	zbuffer_t* m_zbuffer;
-	void draw_triangle(IShaderProgram<Vertex, Varying>& shaderProgram, Varying& a, Varying& b, Varying& c);
-	std::vector<Varying> processVertices(IShaderProgram<Vertex, Varying>& shaderProgram, std::vector<Vertex>& vertexBuffer);
-	int edge2d(ipoint2d const& a, ipoint2d const& b, ipoint2d const& p);
+	bool m_inFrame = false;
+
+	renderMode m_renderMode = SERIAL;
+	shadingMode m_shadingMode = FORWARD;
+	std::unique_ptr<ThreadPool> m_threadPool;
+	std::unique_ptr<FrameWriter> m_frameWriter; // ASYNCHRONOUS presents only
+	int m_tilesX, m_tilesY;
+	// Tile indices in Morton (Z curve) order, the order BINNED mode hands tiles to threads in, so that tiles in
+	// flight at once are close together on screen and more of the texels they sample are shared in cache
+	std::vector<int> m_tileOrder;
+	int m_precisionBits, m_precision, m_half; // subpixel precision, 1 << m_precisionBits and half of that
+	bool m_wideEdges; // whether edge functions need 64 bit math, see constructor
+	float m_guardBand; // guard band half extent in NDC units, i.e. x, y in [-m_guardBand, m_guardBand]
+
+	// Output of vertex processing, kept to reuse the allocations: the projected (screen space) varyings, and
+	// the clip space positions and clip codes of the same vertices for primitive assembly
+	std::vector<Varying> m_processedVertices;
+	std::vector<glm::vec4> m_clipPositions;
+	std::vector<uint16_t> m_clipCodes;
+	std::deque<Varying> m_clippedVertices; // vertices created by clipping in the current draw call (SERIAL only)
+
+	// Triangles set up by one batch of the BINNED setup stage, along with any vertices created by clipping
+	// them (a deque, so that the setups' pointers to them stay valid as it grows)
+	template <typename EdgeT>
+	struct SetupBatch {
+		std::vector<TriangleSetup<Varying, EdgeT>> triangles;
+		std::deque<Varying> clippedVertices;
+	};
+	// State of the BINNED path for one edge function type, kept to reuse its allocations between draw calls. SERIAL
+	// VISIBILITY_BUFFER draws also use it, to keep all their triangles set up until shading
+	template <typename EdgeT>
+	struct BinnedState {
+		std::vector<SetupBatch<EdgeT>> batches;
+		std::vector<std::vector<const TriangleSetup<Varying, EdgeT>*>> bins; // per tile, triangles in submission order
+		std::vector<const TriangleSetup<Varying, EdgeT>*> triangles; // by triangle ID (VISIBILITY_BUFFER only)
+	};
+	BinnedState<int> m_binned;
+	BinnedState<int64_t> m_binnedWide;
+
+	template <typename EdgeT, typename Program>
+	void draw_serial(Program& shaderProgram, std::vector<int>& indexBuffer, BinnedState<EdgeT>& state);
+	template <typename EdgeT, typename Program>
+	void draw_binned(Program& shaderProgram, std::vector<int>& indexBuffer, BinnedState<EdgeT>& state);
+	uint16_t clip_code(const glm::vec4& position) const;
+	template <typename EdgeT, typename Program, typename Emit>
+	void assemble_triangle(Program& shaderProgram, const int* indices, std::deque<Varying>& clippedVertices, Emit&& emit);
+	template <typename EdgeT, typename Program, typename Emit>
+	void clip_triangle(Program& shaderProgram, const int* indices, uint16_t clipCodes, std::deque<Varying>& clippedVertices, Emit&& emit);
+	template <typename EdgeT>
+	bool setup_triangle(const Varying& a, const Varying& b, const Varying& c, TriangleSetup<Varying, EdgeT>& setup);
+	template <rasterPass Pass, typename EdgeT, typename Program>
+	void rasterize_triangle(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup, ipoint2d clipMin, ipoint2d clipMax);
+	void update_hierarchical_z(ipoint2d block, int zMin, int zMax);
+	template <rasterPass Pass, bool TestEdges, typename EdgeT, typename Program>
+	bool rasterize_block(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup,
+		ipoint2d blockPos, ipoint2d rectMin, ipoint2d rectMax, EdgeT wa, EdgeT wb, EdgeT wc, float z, float invW, bool depthPasses);
+	template <typename EdgeT, typename Program>
+	void resolve_visibility(Program& shaderProgram, const std::vector<const TriangleSetup<Varying, EdgeT>*>& triangles,
+		ipoint2d rectMin, ipoint2d rectMax);
+	template <typename Program, typename EdgeT>
+	void shade_fragments(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup, const QuadRow<EdgeT>& quadRow, Varying& fragment);
+	template <typename Program, typename EdgeT>
+	void shade_batch(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup, const QuadRow<EdgeT>& quadRow);
+	template <typename EdgeT>
+	static float barycentrics(const TriangleSetup<Varying, EdgeT>& setup, const QuadRow<EdgeT>& quadRow, int row, int lane,
+		float& ba, float& bb, float& bc);
+	template <typename Program>
+	static void interpolate_varying(Program& shaderProgram, const Varying& a, const Varying& b, const Varying& c, float ba, float bb, float bc, Varying& out);
+	template <typename Program>
+	void processVertices(Program& shaderProgram, std::vector<Vertex>& vertexBuffer);
+	template <typename EdgeT>
+	static EdgeT edge2d(ipoint2d const& a, ipoint2d const& b, ipoint2d const& p);
+	static int depth_bound(float z, int margin);
 	// disable copy constructor and assignment operator for now (don't need them)
 	Renderer(const Renderer&) = delete;
 	Renderer& operator=(const Renderer&) = delete;
 public:
-	Renderer(int width, int height);
-	~Renderer();
-	void draw(IShaderProgram<Vertex, Varying>& shaderProgram, std::vector<Vertex>& vertexBuffer, std::vector<int>& indexBuffer, const char* filename);
+	// subpixelBits is clamped to [1, MAX_PRECISION_BITS]
+	Renderer(int width, int height, int subpixelBits = PRECISION_BITS);
+	// threadCount <= 0 uses all hardware threads (only relevant to BINNED mode)
+	void setRenderMode(renderMode mode, int threadCount = 0);
+	// Threads used for vertex processing (in either mode) and BINNED rasterization. Without a call to this
+	// (or to setRenderMode with BINNED) no threads are used, otherwise vertexShader is called concurrently
+	// so must not modify shared state. threadCount <= 0 uses all hardware threads
+	void setThreadCount(int threadCount);
+	void setShadingMode(shadingMode mode);
+	// For ASYNCHRONOUS, up to maxFramesInFlight frames are held waiting to be written (each a copy of the colour
+	// image), by writerThreads threads. Changing mode first waits for any frames in flight to be written (call
+	// finishPresents first to find out whether they were)
+	void setPresentMode(presentMode mode, int maxFramesInFlight = 2, int writerThreads = 1);
+	// Program is either an IShaderProgram (virtual dispatch), or any concrete type satisfying ShaderProgram, in
+	// which case draw is compiled for it and its shader calls can be inlined into the raster loop
+	template <typename Program> requires ShaderProgram<Program, Vertex, Varying>
+	void draw(Program& shaderProgram, std::vector<Vertex>& vertexBuffer, std::vector<int>& indexBuffer);
+
+	// A frame is beginFrame, then any number of clears and draws into the framebuffer, then endFrame, after which
+	// the framebuffer holds the finished image. Nothing is cleared implicitly and nothing is written out unless the
+	// frame is presented. The framebuffer (like all other storage) is kept between frames, so once the first frame
+	// has been drawn a frame loop does no allocation
+	void beginFrame();
+	// clears colour (clamped to [0, 1]) and depth (to the far plane), deferred per tile so cheap whatever the size
+	void clear(glm::vec3 colour = glm::vec3(0.f));
+	// fills whatever the frame left undrawn with the clear colour
+	void endFrame();
+	// Writes the last finished frame to a file in the given format (see imageFormat), encoding it on the thread pool
+	// if there is one. Returns false if called mid frame or if the file could not be written. In ASYNCHRONOUS mode
+	// the frame is queued to be written instead, and write failures are reported by finishPresents
+	bool present(const char* filename, imageFormat format = TGA);
+	// Waits for every frame queued by an ASYNCHRONOUS present to be written, returning false if any failed. Frames
+	// still in flight are also written when the Renderer is destroyed, but without reporting failure
+	bool finishPresents();
+	Framebuffer& framebuffer() { return m_framebuffer; }
 };
 
 // edge orientation function (+ve if "inside" edge), also relates to barycentric coordinates
-// since this is proportional to the area of the triangle ABP (specifically 2x area of triangle)
+// since this is proportional to the area of the triangle ABP (specifically 2x area of triangle).
+// The coordinate differences always fit in an int, only their products may need EdgeT to be 64 bit
+template<typename Vertex, typename Varying>
+template<typename EdgeT>
+inline EdgeT Renderer<Vertex, Varying>::edge2d(ipoint2d const& a, ipoint2d const& b, ipoint2d const& p) {
+	return EdgeT(b.x - a.x) * (p.y - a.y) - EdgeT(b.y - a.y) * (p.x - a.x);
+}
+
+// Fixed point depth (as stored in the zbuffer) of screen space depth z, moved margin units further (or with a
+// negative margin nearer), which more than covers the float rounding of z in the raster loop
 template<typename Vertex, typename Varying>
-inline int Renderer<Vertex, Varying>::edge2d(ipoint2d const& a, ipoint2d const& b, ipoint2d const& p) {
-	return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+inline int Renderer<Vertex, Varying>::depth_bound(float z, int margin) {
+	return int(std::floor(std::clamp(z, -1.f, 2.f) * ZBUFFMAX + 0.5f)) + margin;
 }
 
 template<typename Vertex, typename Varying>
-inline Renderer<Vertex, Varying>::Renderer(int width, int height)
+inline Renderer<Vertex, Varying>::Renderer(int width, int height, int subpixelBits) :
+	m_framebuffer(width, height)
 {
-	m_zbuffer = new zbuffer_t[width * height];
-	for (int i = 0; i < width * height; i++) {
-		m_zbuffer[i] = ZBUFFMAX;
-	}
-	m_image = TGAImage(width, height, TGAImage::RGB);
 	m_width = width;
 	m_height = height;
+	m_tilesX = (width + TILE_SIZE - 1) >> TILE_BITS;
+	m_tilesY = (height + TILE_SIZE - 1) >> TILE_BITS;
+	auto morton = [](uint32_t x, uint32_t y) {
+		uint64_t code = 0;
+		for (int bit = 0; bit < 32; bit++) {
+			code |= uint64_t((x >> bit) & 1) << (2 * bit) | uint64_t((y >> bit) & 1) << (2 * bit + 1);
+		}
+		return code;
+	};
+	m_tileOrder.resize(m_tilesX * m_tilesY);
+	for (int tile = 0; tile < m_tilesX * m_tilesY; tile++) {
+		m_tileOrder[tile] = tile;
+	}
+	std::sort(m_tileOrder.begin(), m_tileOrder.end(), [&](int a, int b) {
+		return morton(a % m_tilesX, a / m_tilesX) < morton(b % m_tilesX, b / m_tilesX);
+	});
+
+	m_precisionBits = std::clamp(subpixelBits, 1, MAX_PRECISION_BITS);
+	m_precision = 1 << m_precisionBits;
+	m_half = m_precision >> 1;
+
+	// Edge function terms are products of an x and a y difference between subpixel coordinates inside the
+	// guard band (or just past the image edge, for block and tile corners). 32 bit edge math is used whenever
+	// a guard band at least as large as the viewport keeps those products within int range, with the guard
+	// band then made as large as that allows. Otherwise (roughly beyond 2.8K at the default precision) edge
+	// functions are evaluated in 64 bits, where only the subpixel coordinates themselves need to fit in an
+	// int, so the guard band is limited to keep them (and their differences) within half that range
+	double maxArea = double(INT_MAX) / (double(m_precision) * m_precision);
+	double guardBand = std::sqrt(maxArea / (double(width + TILE_SIZE) * double(height + TILE_SIZE)));
+	m_wideEdges = guardBand < 1.0;
+	if (m_wideEdges) {
+		guardBand = double(INT_MAX) / (2.0 * m_precision * (std::max(width, height) + TILE_SIZE));
+	}
+	m_guardBand = float(guardBand);
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::setRenderMode(renderMode mode, int threadCount)
+{
+	m_renderMode = mode;
+	if (mode == BINNED && (!m_threadPool || threadCount > 0)) {
+		setThreadCount(threadCount);
+	}
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::setThreadCount(int threadCount)
+{
+	if (!m_threadPool || threadCount != m_threadPool->size()) {
+		m_threadPool = std::make_unique<ThreadPool>(threadCount);
+	}
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::setShadingMode(shadingMode mode)
+{
+	m_shadingMode = mode;
+	if (mode == VISIBILITY_BUFFER) {
+		m_framebuffer.enable_visibility();
+	}
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::setPresentMode(presentMode mode, int maxFramesInFlight, int writerThreads)
+{
+	// destroying the old writer waits for its frames
+	m_frameWriter.reset();
+	if (mode == ASYNCHRONOUS) {
+		m_frameWriter = std::make_unique<FrameWriter>(maxFramesInFlight, writerThreads);
+	}
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::beginFrame()
+{
+	m_inFrame = true;
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::clear(glm::vec3 colour)
+{
+	m_framebuffer.clear(colour);
+}
+
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::endFrame()
+{
+	m_framebuffer.resolve();
+	m_inFrame = false;
+}
+
+template<typename Vertex, typename Varying>
+inline bool Renderer<Vertex, Varying>::present(const char* filename, imageFormat format)
+{
+	if (m_inFrame) {
+		return false;
+	}
+	if (m_frameWriter) {
+		m_frameWriter->submit(m_framebuffer, filename, format);
+		return true;
+	}
+	return m_framebuffer.write_image(filename, format, m_threadPool.get());
 }
 
 template<typename Vertex, typename Varying>
-inline Renderer<Vertex, Varying>::~Renderer()
+inline bool Renderer<Vertex, Varying>::finishPresents()
 {
-	delete[] m_zbuffer;
+	return !m_frameWriter || m_frameWriter->flush();
 }
 
 // TODO: consider adding a Buffer class rather than passing a vertex and index buffer, then can maybe just use a
 // get next triangle function or something instead of having to overload the function for an unindexed verison...
 template<typename Vertex, typename Varying>
-inline void Renderer<Vertex, Varying>::draw(IShaderProgram<Vertex, Varying>& shaderProgram, std::vector<Vertex>& vertexBuffer, std::vector<int>& indexBuffer, const char* filename)
+template<typename Program> requires ShaderProgram<Program, Vertex, Varying>
+inline void Renderer<Vertex, Varying>::draw(Program& shaderProgram, std::vector<Vertex>& vertexBuffer, std::vector<int>& indexBuffer)
 {
+	static_assert(FlatVarying<Varying> || CustomInterpolation<Program, Varying>,
+		"Varying must start with gl_Position followed only by floats, or the program must provide interpolate");
+
 	// Vertex processing stage (vertex shader, perspective divide, viewport transformation)
-	std::vector<Varying> processedVertices = processVertices(shaderProgram, vertexBuffer);
+	processVertices(shaderProgram, vertexBuffer);
 
-	// Read each triangle from the index buffer and rasterize it
-	for (int i = 0; i < indexBuffer.size() - 2; i += 3) {
-		draw_triangle(shaderProgram,
-			processedVertices[indexBuffer[i]],
-			processedVertices[indexBuffer[i+1]],
-			processedVertices[indexBuffer[i+2]]
-		);
+	if (m_renderMode == BINNED) {
+		if (m_wideEdges) {
+			draw_binned(shaderProgram, indexBuffer, m_binnedWide);
+		}
+		else {
+			draw_binned(shaderProgram, indexBuffer, m_binned);
+		}
+	}
+	else {
+		if (m_wideEdges) {
+			draw_serial(shaderProgram, indexBuffer, m_binnedWide);
+		}
+		else {
+			draw_serial(shaderProgram, indexBuffer, m_binned);
+		}
 	}
+}
+
+// Vertices are processed in batches small enough for a batch's inputs and outputs to stay in L1 cache, with
+// batches spread across the thread pool (if any). Output goes to m_processedVertices, whose storage is reused
+// between draw calls
+template<typename Vertex, typename Varying>
+template<typename Program>
+inline void Renderer<Vertex, Varying>::processVertices(Program& shaderProgram, std::vector<Vertex>& vertexBuffer)
+{
+	constexpr int VERTEX_BATCH = std::max<int>(64, (32 * 1024) / (sizeof(Vertex) + sizeof(Varying)));
+	int vertexCount = (int)vertexBuffer.size();
+	m_processedVertices.resize(vertexCount);
+	m_clipPositions.resize(vertexCount);
+	m_clipCodes.resize(vertexCount);
+	Varying* out = m_processedVertices.data();
+	auto processBatch = [&](int batch) {
+		int end = std::min(vertexCount, (batch + 1) * VERTEX_BATCH);
+		for (int i = batch * VERTEX_BATCH; i < end; i++) {
+			// vertex shader
+			out[i] = shaderProgram.vertexShader(vertexBuffer[i]);
+
+			// clipping and culling happen per primitive during primitive assembly, which needs the clip space
+			// position, but projecting every vertex here keeps the common (unclipped) case cheap
+			m_clipPositions[i] = out[i].gl_Position;
+			m_clipCodes[i] = clip_code(out[i].gl_Position);
+
+			// perspective divide, and viewport transform from NDC [-1,1] to screenspace ([0, width], [0, height], [0, 1])
+			// coordinates, with w replaced by 1/w for perspective correct interpolation
+			simd::project(&out[i].gl_Position[0], float(m_width), float(m_height), 1.f);
+		}
+	};
 
-	m_image.flip_vertically(); // so that origin (0,0) is bottom left, not top left
-	m_image.write_tga_file(filename);
+	int batches = (vertexCount + VERTEX_BATCH - 1) / VERTEX_BATCH;
+	if (m_threadPool) {
+		m_threadPool->parallel_for(batches, processBatch);
+	}
+	else {
+		for (int batch = 0; batch < batches; batch++) {
+			processBatch(batch);
+		}
+	}
 }
 
+
 template<typename Vertex, typename Varying>
-inline std::vector<Varying> Renderer<Vertex, Varying>::processVertices(IShaderProgram<Vertex, Varying>& shaderProgram, std::vector<Vertex>& vertexBuffer)
+inline uint16_t Renderer<Vertex, Varying>::clip_code(const glm::vec4& p) const
 {
-	std::vector<Varying> ret = std::vector<Varying>(vertexBuffer.size());
-	for (int i = 0; i < vertexBuffer.size(); i++) {
-		// vertex shader
-		ret[i] = shaderProgram.vertexShader(vertexBuffer[i]);
+	float gb = m_guardBand * p.w;
+	return (p.x < -p.w ? CLIP_LEFT : 0) | (p.x > p.w ? CLIP_RIGHT : 0) |
+		(p.y < -p.w ? CLIP_BOTTOM : 0) | (p.y > p.w ? CLIP_TOP : 0) |
+		(p.z < -p.w ? CLIP_NEAR : 0) | (p.z > p.w ? CLIP_FAR : 0) |
+		(p.x < -gb ? CLIP_GB_LEFT : 0) | (p.x > gb ? CLIP_GB_RIGHT : 0) |
+		(p.y < -gb ? CLIP_GB_BOTTOM : 0) | (p.y > gb ? CLIP_GB_TOP : 0);
+}
 
-		// perspective divide
-		ret[i].gl_Position.x = ret[i].gl_Position.x / ret[i].gl_Position.w;
-		ret[i].gl_Position.y = ret[i].gl_Position.y / ret[i].gl_Position.w;
-		ret[i].gl_Position.z = ret[i].gl_Position.z / ret[i].gl_Position.w;
-		ret[i].gl_Position.w = 1.f / ret[i].gl_Position.w;
+// Read each triangle from the index buffer, assemble (cull and clip) it and rasterize the result. A DEPTH_PREPASS
+// simply does this twice, while VISIBILITY_BUFFER keeps every triangle's setup (in state) for shading afterwards
+template<typename Vertex, typename Varying>
+template<typename EdgeT, typename Program>
+inline void Renderer<Vertex, Varying>::draw_serial(Program& shaderProgram, std::vector<int>& indexBuffer, BinnedState<EdgeT>& state)
+{
+	const ipoint2d imageMin = { 0, 0 };
+	const ipoint2d imageMax = { m_width - 1, m_height - 1 };
+	m_clippedVertices.clear();
+	if (m_shadingMode == VISIBILITY_BUFFER) {
+		state.batches.resize(1);
+		SetupBatch<EdgeT>& setups = state.batches[0];
+		setups.triangles.clear();
+		setups.clippedVertices.clear();
+		for (int i = 0; i + 2 < indexBuffer.size(); i += 3) {
+			assemble_triangle<EdgeT>(shaderProgram, &indexBuffer[i], setups.clippedVertices, [&setups](const TriangleSetup<Varying, EdgeT>& setup) {
+				setups.triangles.push_back(setup);
+			});
+		}
+		state.triangles.clear();
+		for (TriangleSetup<Varying, EdgeT>& setup : setups.triangles) {
+			setup.id = uint32_t(state.triangles.size());
+			state.triangles.push_back(&setup);
+			rasterize_triangle<RASTER_VISIBILITY>(shaderProgram, setup, imageMin, imageMax);
+		}
+		resolve_visibility(shaderProgram, state.triangles, imageMin, imageMax);
+		return;
+	}
 
-		// TODO: CLIPPING AND CULLING STAGE GOES HERE
-		// (actually no since clipping and culling is performed on primitives, not on
-		// vertices, so will require a bit of refactoring to implement)
-		// should be done after vertex processing as part of primitive assembly
+	if (m_shadingMode == DEPTH_PREPASS) {
+		for (int i = 0; i + 2 < indexBuffer.size(); i += 3) {
+			assemble_triangle<EdgeT>(shaderProgram, &indexBuffer[i], m_clippedVertices, [&](const TriangleSetup<Varying, EdgeT>& setup) {
+				rasterize_triangle<RASTER_DEPTH>(shaderProgram, setup, imageMin, imageMax);
+			});
+		}
+		m_clippedVertices.clear();
+	}
+	for (int i = 0; i + 2 < indexBuffer.size(); i += 3) {
+		assemble_triangle<EdgeT>(shaderProgram, &indexBuffer[i], m_clippedVertices, [&](const TriangleSetup<Varying, EdgeT>& setup) {
+			if (m_shadingMode == DEPTH_PREPASS) {
+				rasterize_triangle<RASTER_DEPTH_EQUAL>(shaderProgram, setup, imageMin, imageMax);
+			}
+			else {
+				rasterize_triangle<RASTER_SHADE>(shaderProgram, setup, imageMin, imageMax);
+			}
+		});
+	}
+}
 
-		// viewport transform from NDC [-1,1] to screenspace ([0, width], [0, height], [0, 1]) coordinates
-		ret[i].gl_Position.x = (ret[i].gl_Position.x + 1.f) * m_width / 2.f;
-		ret[i].gl_Position.y = (ret[i].gl_Position.y + 1.f) * m_height / 2.f;
-		ret[i].gl_Position.z = (ret[i].gl_Position.z + 1.f) * 0.5f;
+// Primitive assembly of the triangle with the given 3 indices: rejects it if all its vertices lie outside the
+// same frustum plane, sets it up directly if it needs no clipping (by far the common case), and clips it
+// otherwise. emit is called with the setup of every resulting visible triangle
+template<typename Vertex, typename Varying>
+template<typename EdgeT, typename Program, typename Emit>
+inline void Renderer<Vertex, Varying>::assemble_triangle(Program& shaderProgram, const int* indices, std::deque<Varying>& clippedVertices, Emit&& emit)
+{
+	uint16_t ca = m_clipCodes[indices[0]];
+	uint16_t cb = m_clipCodes[indices[1]];
+	uint16_t cc = m_clipCodes[indices[2]];
+	if (ca & cb & cc & CLIP_FRUSTUM) {
+		return;
+	}
+	if (((ca | cb | cc) & CLIP_REQUIRED) == 0) {
+		TriangleSetup<Varying, EdgeT> setup;
+		if (setup_triangle(m_processedVertices[indices[0]], m_processedVertices[indices[1]], m_processedVertices[indices[2]], setup)) {
+			emit(setup);
+		}
+		return;
 	}
-	return ret;
+	clip_triangle<EdgeT>(shaderProgram, indices, ca | cb | cc, clippedVertices, emit);
 }
 
+// Clips a triangle in homogeneous clip space against each of the near, far and guard band planes its vertices'
+// clip codes say it crosses (Sutherland-Hodgman, one plane at a time), then projects the resulting convex
+// polygon and sets it up as a fan of triangles. The polygon's vertices are appended to clippedVertices, which
+// must outlive any use of the emitted setups
+template<typename Vertex, typename Varying>
+template<typename EdgeT, typename Program, typename Emit>
+inline void Renderer<Vertex, Varying>::clip_triangle(Program& shaderProgram, const int* indices, uint16_t clipCodes, std::deque<Varying>& clippedVertices, Emit&& emit)
+{
+	// each plane clipped against adds at most one vertex
+	constexpr int MAX_POLYGON = 3 + 6;
+	Varying polygons[2][MAX_POLYGON];
+	Varying* in = polygons[0];
+	Varying* out = polygons[1];
+	int count = 3;
+	for (int i = 0; i < 3; i++) {
+		in[i] = m_processedVertices[indices[i]];
+		in[i].gl_Position = m_clipPositions[indices[i]];
+	}
+
+	// signed distance to a clip plane, non-negative on the inside
+	auto distance = [this](const glm::vec4& p, uint16_t plane) {
+		switch (plane) {
+		case CLIP_NEAR: return p.z + p.w;
+		case CLIP_FAR: return p.w - p.z;
+		case CLIP_GB_LEFT: return m_guardBand * p.w + p.x;
+		case CLIP_GB_RIGHT: return m_guardBand * p.w - p.x;
+		case CLIP_GB_BOTTOM: return m_guardBand * p.w + p.y;
+		default: return m_guardBand * p.w - p.y;
+		}
+	};
+	// new vertex where the edge from an inside to an outside vertex meets the plane. Always interpolating
+	// in that direction means an edge shared by two triangles is split at exactly the same point for both.
+	// Clip space is linear (before the perspective divide), so the varyings are interpolated linearly too
+	auto intersect = [&shaderProgram](const Varying& inside, const Varying& outside, float dIn, float dOut) {
+		float t = dIn / (dIn - dOut);
+		Varying v;
+		interpolate_varying(shaderProgram, inside, outside, outside, 1.f - t, t, 0.f, v);
+		v.gl_Position = inside.gl_Position + (outside.gl_Position - inside.gl_Position) * t;
+		return v;
+	};
 
+	// a vertex created by clipping is a blend of two vertices inside any plane both were inside, so the
+	// original clip codes cover every plane the polygon can cross
+	for (uint16_t plane = CLIP_NEAR; plane <= CLIP_GB_TOP; plane <<= 1) {
+		if (!(clipCodes & plane)) continue;
+		int outCount = 0;
+		const Varying* prev = &in[count - 1];
+		float dPrev = distance(prev->gl_Position, plane);
+		for (int i = 0; i < count; i++) {
+			float d = distance(in[i].gl_Position, plane);
+			if (dPrev >= 0.f && d < 0.f) {
+				out[outCount++] = intersect(*prev, in[i], dPrev, d);
+			}
+			else if (dPrev < 0.f && d >= 0.f) {
+				out[outCount++] = intersect(in[i], *prev, d, dPrev);
+			}
+			if (d >= 0.f) {
+				out[outCount++] = in[i];
+			}
+			prev = &in[i];
+			dPrev = d;
+		}
+		std::swap(in, out);
+		count = outCount;
+		if (count < 3) return;
+	}
+
+	// perspective divide and viewport transform, as for unclipped vertices in processVertices
+	size_t first = clippedVertices.size();
+	for (int i = 0; i < count; i++) {
+		clippedVertices.push_back(in[i]);
+		simd::project(&clippedVertices.back().gl_Position[0], float(m_width), float(m_height), 1.f);
+	}
+	TriangleSetup<Varying, EdgeT> setup;
+	for (int i = 1; i + 1 < count; i++) {
+		if (setup_triangle(clippedVertices[first], clippedVertices[first + i], clippedVertices[first + i + 1], setup)) {
+			emit(setup);
+		}
+	}
+}
+
+// Sort-middle rendering: assemble and set up all triangles (in parallel batches), bin them into the screen tiles
+// they touch in submission order, then rasterize each tile's bin on its own thread. Tiles never share pixels, so
+// no locking of the colour or depth buffers is needed, and since every pixel still sees its triangles in
+// submission order the result matches the serial path exactly
 template<typename Vertex, typename Varying>
-inline void Renderer<Vertex, Varying>::draw_triangle(IShaderProgram<Vertex, Varying>& shaderProgram, Varying& a, Varying& b, Varying& c)
+template<typename EdgeT, typename Program>
+inline void Renderer<Vertex, Varying>::draw_binned(Program& shaderProgram, std::vector<int>& indexBuffer, BinnedState<EdgeT>& state)
 {
-	// snap triangle corners to integer pixel grid
-	// TODO: sub-pixel precision (e.g. 28.4 or 26.6 fixed point integer arithmetic) - do not forget to evaluate
-	// at pixel CENTERS (e.g. x=5.5, y=6.5 instead of x=5, y=6) when performing pixel membership tests
-	ipoint2d a_pos = { std::roundf(a.gl_Position.x * PRECISION), std::roundf(a.gl_Position.y * PRECISION) };
-	ipoint2d b_pos = { std::roundf(b.gl_Position.x * PRECISION), std::roundf(b.gl_Position.y * PRECISION) };
-	ipoint2d c_pos = { std::roundf(c.gl_Position.x * PRECISION), std::roundf(c.gl_Position.y * PRECISION) };
+	constexpr int SETUP_BATCH = 1024;
+	int triangleCount = (int)indexBuffer.size() / 3;
+	int batches = (triangleCount + SETUP_BATCH - 1) / SETUP_BATCH;
+	state.batches.resize(batches);
+	m_threadPool->parallel_for(batches, [&](int batch) {
+		SetupBatch<EdgeT>& output = state.batches[batch];
+		output.triangles.clear();
+		output.clippedVertices.clear();
+		int end = std::min(triangleCount, (batch + 1) * SETUP_BATCH);
+		for (int i = batch * SETUP_BATCH; i < end; i++) {
+			assemble_triangle<EdgeT>(shaderProgram, &indexBuffer[3 * i], output.clippedVertices, [&output](const TriangleSetup<Varying, EdgeT>& setup) {
+				output.triangles.push_back(setup);
+			});
+		}
+	});
 
-	int area = edge2d(a_pos, b_pos, c_pos);
+	// Binning, reusing the bins' storage between draw calls
+	state.bins.resize(m_tilesX * m_tilesY);
+	for (std::vector<const TriangleSetup<Varying, EdgeT>*>& bin : state.bins) {
+		bin.clear();
+	}
+	state.triangles.clear();
+	for (SetupBatch<EdgeT>& batch : state.batches) {
+		for (TriangleSetup<Varying, EdgeT>& setup : batch.triangles) {
+			if (m_shadingMode == VISIBILITY_BUFFER) {
+				setup.id = uint32_t(state.triangles.size());
+				state.triangles.push_back(&setup);
+			}
+			// tile corner offsets for the trivial reject test, as for blocks during rasterization
+			EdgeT rejectA = std::max<EdgeT>(setup.wa.stepX, 0) * (TILE_SIZE - 1) + std::max<EdgeT>(setup.wa.stepY, 0) * (TILE_SIZE - 1);
+			EdgeT rejectB = std::max<EdgeT>(setup.wb.stepX, 0) * (TILE_SIZE - 1) + std::max<EdgeT>(setup.wb.stepY, 0) * (TILE_SIZE - 1);
+			EdgeT rejectC = std::max<EdgeT>(setup.wc.stepX, 0) * (TILE_SIZE - 1) + std::max<EdgeT>(setup.wc.stepY, 0) * (TILE_SIZE - 1);
+			for (int ty = setup.bbMin.y >> TILE_BITS; ty <= setup.bbMax.y >> TILE_BITS; ty++) {
+				for (int tx = setup.bbMin.x >> TILE_BITS; tx <= setup.bbMax.x >> TILE_BITS; tx++) {
+					int dx = (tx << TILE_BITS) - setup.origin.x;
+					int dy = (ty << TILE_BITS) - setup.origin.y;
+					if (setup.wa.origin + setup.wa.stepX * dx + setup.wa.stepY * dy + rejectA < 0 ||
+						setup.wb.origin + setup.wb.stepX * dx + setup.wb.stepY * dy + rejectB < 0 ||
+						setup.wc.origin + setup.wc.stepX * dx + setup.wc.stepY * dy + rejectC < 0) {
+						continue;
+					}
+					state.bins[ty * m_tilesX + tx].push_back(&setup);
+				}
+			}
+		}
+	}
+
+	// with a depth prepass or visibility buffer, each tile runs both of its passes while it is still in cache
+	m_threadPool->parallel_for(m_tilesX * m_tilesY, [&](int i) {
+		int tile = m_tileOrder[i];
+		ipoint2d tileMin = { (tile % m_tilesX) << TILE_BITS, (tile / m_tilesX) << TILE_BITS };
+		ipoint2d tileMax = { std::min(tileMin.x + TILE_SIZE, m_width) - 1, std::min(tileMin.y + TILE_SIZE, m_height) - 1 };
+		const std::vector<const TriangleSetup<Varying, EdgeT>*>& bin = state.bins[tile];
+		switch (m_shadingMode) {
+		case FORWARD:
+			for (const TriangleSetup<Varying, EdgeT>* setup : bin) {
+				rasterize_triangle<RASTER_SHADE>(shaderProgram, *setup, tileMin, tileMax);
+			}
+			break;
+		case DEPTH_PREPASS:
+			for (const TriangleSetup<Varying, EdgeT>* setup : bin) {
+				rasterize_triangle<RASTER_DEPTH>(shaderProgram, *setup, tileMin, tileMax);
+			}
+			for (const TriangleSetup<Varying, EdgeT>* setup : bin) {
+				rasterize_triangle<RASTER_DEPTH_EQUAL>(shaderProgram, *setup, tileMin, tileMax);
+			}
+			break;
+		case VISIBILITY_BUFFER:
+			for (const TriangleSetup<Varying, EdgeT>* setup : bin) {
+				rasterize_triangle<RASTER_VISIBILITY>(shaderProgram, *setup, tileMin, tileMax);
+			}
+			resolve_visibility(shaderProgram, state.triangles, tileMin, tileMax);
+			break;
+		}
+	});
+}
+
+// Triangle setup: snaps vertices to the subpixel grid, performs back-face culling, computes the clipped
+// bounding box and the incremental edge, z and 1/w equations used by the raster loop. Returns false if the
+// triangle produces no fragments
+template<typename Vertex, typename Varying>
+template<typename EdgeT>
+inline bool Renderer<Vertex, Varying>::setup_triangle(const Varying& a, const Varying& b, const Varying& c, TriangleSetup<Varying, EdgeT>& setup)
+{
+	// snap triangle corners to subpixel grid
+	const float precision = float(m_precision);
+	ipoint2d a_pos = { std::roundf(a.gl_Position.x * precision), std::roundf(a.gl_Position.y * precision) };
+	ipoint2d b_pos = { std::roundf(b.gl_Position.x * precision), std::roundf(b.gl_Position.y * precision) };
+	ipoint2d c_pos = { std::roundf(c.gl_Position.x * precision), std::roundf(c.gl_Position.y * precision) };
+
+	EdgeT area = edge2d<EdgeT>(a_pos, b_pos, c_pos);
 	// if area 0 then degenerate, if area <0 then backfacing (assuming all triangles correctly
 	// wound CCW), so reject early
 	if (area <= 0) {
-		return;
+		return false;
 	}
-	float normFactor = 1.0f / area;
 
 	// compute bounding box of triangle
 	ipoint2d bbMin = ipoint2d{ std::min(std::min(a_pos.x, b_pos.x), c_pos.x),
@@ -133,55 +704,521 @@ inline void Renderer<Vertex, Varying>::draw_triangle(IShaderProgram<Vertex, Vary
 		std::max(std::max(a_pos.y, b_pos.y), c_pos.y) };
 
 	// clip to image dimensions (and convert to pixel grid integers)
-	bbMin.x = (std::max(bbMin.x, 0) + HALF) >> PRECISION_BITS;
-	bbMin.y = (std::max(bbMin.y, 0) + HALF) >> PRECISION_BITS;
-	bbMax.x = (std::min(bbMax.x, m_width * PRECISION - 1) - HALF) >> PRECISION_BITS;
-	bbMax.y = (std::min(bbMax.y, m_height * PRECISION - 1) - HALF) >> PRECISION_BITS;
-
-	// Iterate over every pixel in bounding box, if pixel is within triangle (determined via edge signed 
-	// distance functions, which closely relate to barycentric coordinates) then draw it.
-	ipoint2d p{};
-	for (p.y = bbMin.y; p.y <= bbMax.y; p.y++) {
-		for (p.x = bbMin.x; p.x <= bbMax.x; p.x++) {
-			// bit messy having to convert from integer pixels to fixed point pixel centers, but this
-			// problem will solve itself when switching to the more efficient increment based loop
-			ipoint2d pF = { (p.x << PRECISION_BITS) + HALF, (p.y << PRECISION_BITS) + HALF };
-			int wa = edge2d(b_pos, c_pos, pF);
-			int wb = edge2d(c_pos, a_pos, pF);
-			int wc = edge2d(a_pos, b_pos, pF);
+	bbMin.x = (std::max(bbMin.x, 0) + m_half) >> m_precisionBits;
+	bbMin.y = (std::max(bbMin.y, 0) + m_half) >> m_precisionBits;
+	bbMax.x = (std::min(bbMax.x, m_width * m_precision - 1) - m_half) >> m_precisionBits;
+	bbMax.y = (std::min(bbMax.y, m_height * m_precision - 1) - m_half) >> m_precisionBits;
+	if (bbMin.x > bbMax.x || bbMin.y > bbMax.y) {
+		return false;
+	}
+
+	// edge functions are linear, so E(p + (1,0)) - E(p) is constant (and likewise for y), only the value
+	// at the first pixel center needs a full evaluation
+	setup.origin = { bbMin.x & ~(BLOCK_SIZE - 1), bbMin.y & ~(BLOCK_SIZE - 1) };
+	ipoint2d origin = { (setup.origin.x << m_precisionBits) + m_half, (setup.origin.y << m_precisionBits) + m_half };
+	auto makeEdge = [this, &origin](ipoint2d const& v0, ipoint2d const& v1) {
+		EdgeEquation<EdgeT> e;
+		e.origin = edge2d<EdgeT>(v0, v1, origin);
+		e.stepX = EdgeT(v0.y - v1.y) * m_precision;
+		e.stepY = EdgeT(v1.x - v0.x) * m_precision;
+		e.blockMinOffset = std::min<EdgeT>(e.stepX, 0) * (BLOCK_SIZE - 1) + std::min<EdgeT>(e.stepY, 0) * (BLOCK_SIZE - 1);
+		e.blockMaxOffset = std::max<EdgeT>(e.stepX, 0) * (BLOCK_SIZE - 1) + std::max<EdgeT>(e.stepY, 0) * (BLOCK_SIZE - 1);
+		return e;
+	};
+	setup.wa = makeEdge(b_pos, c_pos);
+	setup.wb = makeEdge(c_pos, a_pos);
+	setup.wc = makeEdge(a_pos, b_pos);
+
+	// any attribute linear in screen space is a barycentric weighted sum of its vertex values, hence its
+	// plane equation follows directly from the edge equations (done in double as the edge values are large)
+	double norm = 1.0 / double(area);
+	auto makePlane = [&setup, norm](float va, float vb, float vc) {
+		PlaneEquation p;
+		p.origin = float((double(setup.wa.origin) * va + double(setup.wb.origin) * vb + double(setup.wc.origin) * vc) * norm);
+		p.stepX = float((double(setup.wa.stepX) * va + double(setup.wb.stepX) * vb + double(setup.wc.stepX) * vc) * norm);
+		p.stepY = float((double(setup.wa.stepY) * va + double(setup.wb.stepY) * vb + double(setup.wc.stepY) * vc) * norm);
+		return p;
+	};
+	setup.z = makePlane(a.gl_Position.z, b.gl_Position.z, c.gl_Position.z);
+	setup.invW = makePlane(a.gl_Position.w, b.gl_Position.w, c.gl_Position.w);
+	setup.zMin = depth_bound(std::min(std::min(a.gl_Position.z, b.gl_Position.z), c.gl_Position.z), -1);
+	setup.zMax = depth_bound(std::max(std::max(a.gl_Position.z, b.gl_Position.z), c.gl_Position.z), 1);
+
+	setup.a = &a;
+	setup.b = &b;
+	setup.c = &c;
+	setup.bbMin = bbMin;
+	setup.bbMax = bbMax;
+	setup.normFactor = float(norm);
+	return true;
+}
+
+// Writes the varying with barycentric weights (ba, bb, bc) of a, b and c into out, except for gl_Position which is
+// left to the caller. Uses the program's own interpolate if it has one (see CustomInterpolation), otherwise every
+// attribute float is interpolated in a single loop over the flat Varying, which the compiler can vectorize
+template<typename Vertex, typename Varying>
+template<typename Program>
+inline void Renderer<Vertex, Varying>::interpolate_varying(Program& shaderProgram, const Varying& a, const Varying& b, const Varying& c, float ba, float bb, float bc, Varying& out)
+{
+	if constexpr (CustomInterpolation<Program, Varying>) {
+		out = shaderProgram.interpolate(a, b, c, ba, bb, bc);
+	}
+	else {
+		const float* va = VaryingAttributes<Varying>::get(a);
+		const float* vb = VaryingAttributes<Varying>::get(b);
+		const float* vc = VaryingAttributes<Varying>::get(c);
+		float* vout = VaryingAttributes<Varying>::get(out);
+		for (int i = 0; i < VaryingAttributes<Varying>::COUNT; i++) {
+			vout[i] = ba * va[i] + bb * vb[i] + bc * vc[i];
+		}
+	}
+}
+
+// Coarse rasterization: walks the block grid covering the bounding box (restricted to the clip rectangle),
+// classifying each block against the three edges by their values at the block's extreme corners. Blocks
+// outside any edge are skipped entirely, blocks inside all edges are filled without edge tests, and only
+// blocks straddling an edge test each pixel. Callers rasterizing tiles in parallel must use tiles aligned to the
+// block grid, as the SIMD depth test rewrites whole block rows
+template<typename Vertex, typename Varying>
+template<rasterPass Pass, typename EdgeT, typename Program>
+inline void Renderer<Vertex, Varying>::rasterize_triangle(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup, ipoint2d clipMin, ipoint2d clipMax)
+{
+	const EdgeEquation<EdgeT>& ea = setup.wa;
+	const EdgeEquation<EdgeT>& eb = setup.wb;
+	const EdgeEquation<EdgeT>& ec = setup.wc;
+	ipoint2d rectMin = { std::max(setup.bbMin.x, clipMin.x), std::max(setup.bbMin.y, clipMin.y) };
+	ipoint2d rectMax = { std::min(setup.bbMax.x, clipMax.x), std::min(setup.bbMax.y, clipMax.y) };
+
+	// whether depths from zMin up would all fail the depth test against stored depths up to farthest
+	auto hidden = [](int zMin, int farthest) {
+		return Pass == RASTER_DEPTH_EQUAL ? zMin > farthest : zMin >= farthest;
+	};
+	// the tiles are first brought up to date with any deferred clear
+	int farthest = 0;
+	for (int ty = rectMin.y >> TILE_BITS; ty <= rectMax.y >> TILE_BITS; ty++) {
+		for (int tx = rectMin.x >> TILE_BITS; tx <= rectMax.x >> TILE_BITS; tx++) {
+			m_framebuffer.prepare_tile(ty * m_tilesX + tx);
+			farthest = std::max<int>(farthest, m_framebuffer.m_tileMaxZ[ty * m_tilesX + tx]);
+		}
+	}
+	if (hidden(setup.zMin, farthest)) {
+		return;
+	}
+	// offsets from a block's first pixel to its corners with the lowest/highest z, as for the edges
+	float zMinOffset = (std::min(setup.z.stepX, 0.f) + std::min(setup.z.stepY, 0.f)) * (BLOCK_SIZE - 1);
+	float zMaxOffset = (std::max(setup.z.stepX, 0.f) + std::max(setup.z.stepY, 0.f)) * (BLOCK_SIZE - 1);
+
+	// Values at each block's first pixel are evaluated from the equations rather than stepped from block to
+	// block, so they do not depend on where the walk started (i.e. are the same whichever tile draws them)
+	ipoint2d block{};
+	for (block.y = rectMin.y & ~(BLOCK_SIZE - 1); block.y <= rectMax.y; block.y += BLOCK_SIZE) {
+		int dy = block.y - setup.origin.y;
+		for (block.x = rectMin.x & ~(BLOCK_SIZE - 1); block.x <= rectMax.x; block.x += BLOCK_SIZE) {
+			int dx = block.x - setup.origin.x;
+			EdgeT wa = ea.origin + ea.stepX * dx + ea.stepY * dy;
+			EdgeT wb = eb.origin + eb.stepX * dx + eb.stepY * dy;
+			EdgeT wc = ec.origin + ec.stepX * dx + ec.stepY * dy;
+
+			// trivial reject if any edge is negative even at the block corner where it is largest
+			if ((wa + ea.blockMaxOffset) < 0 || (wb + eb.blockMaxOffset) < 0 || (wc + ec.blockMaxOffset) < 0) {
+				continue;
+			}
+			// hierarchical z reject if the triangle is behind everything in the block
+			float z = setup.z.origin + setup.z.stepX * dx + setup.z.stepY * dy;
+			int blockIndex = (block.y >> BLOCK_BITS) * m_framebuffer.m_blocksX + (block.x >> BLOCK_BITS);
+			int zMin = std::max(setup.zMin, depth_bound(z + zMinOffset, -1));
+			if (hidden(zMin, m_framebuffer.m_blockMaxZ[blockIndex])) {
+				continue;
+			}
+			float invW = setup.invW.origin + setup.invW.stepX * dx + setup.invW.stepY * dy;
+			int zMax = std::min(setup.zMax, depth_bound(z + zMaxOffset, 1));
+			// trivial accept if all edges are non-negative even at the corners where they are smallest, in which
+			// case the triangle covers every pixel of the block inside the image if the rectangle does too
+			bool written;
+			if (((wa + ea.blockMinOffset) | (wb + eb.blockMinOffset) | (wc + ec.blockMinOffset)) >= 0) {
+				bool covered = block.x >= rectMin.x && block.y >= rectMin.y &&
+					std::min(block.x + BLOCK_SIZE - 1, m_width - 1) <= rectMax.x && std::min(block.y + BLOCK_SIZE - 1, m_height - 1) <= rectMax.y;
+				bool depthPasses = covered && Pass != RASTER_DEPTH_EQUAL && zMax < m_framebuffer.m_blockMinZ[blockIndex];
+				written = rasterize_block<Pass, false, EdgeT>(shaderProgram, setup, block, rectMin, rectMax, wa, wb, wc, z, invW, depthPasses);
+				if (!covered) {
+					zMax = ZBUFFMAX;
+				}
+			}
+			else {
+				written = rasterize_block<Pass, true, EdgeT>(shaderProgram, setup, block, rectMin, rectMax, wa, wb, wc, z, invW, false);
+				zMax = ZBUFFMAX;
+			}
+			if (Pass != RASTER_DEPTH_EQUAL && written) {
+				update_hierarchical_z(block, zMin, zMax);
+			}
+		}
+	}
+}
+
+// Fine rasterization of a single block, given the edge, z and 1/w values at its first pixel, restricted to
+// the pixels within [rectMin, rectMax] (the bounding box clipped to image and tile). Each block row
+// is processed simd::WIDTH pixels at a time: coverage and the depth test/write both produce
+// lane masks, and only lanes surviving all of them are interpolated and shaded, a pair of rows at a time (or,
+// depending on Pass, have their triangle ID stored, or nothing more). Coverage is only tested if TestEdges is set (i.e. the block was not
+// trivially accepted), otherwise only the bounding box is respected. If depthPasses is set the whole block is known
+// to pass the depth test, so depths are just stored. Returns whether any fragment passed the depth test
+template<typename Vertex, typename Varying>
+template<rasterPass Pass, bool TestEdges, typename EdgeT, typename Program>
+inline bool Renderer<Vertex, Varying>::rasterize_block(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup,
+	ipoint2d blockPos, ipoint2d rectMin, ipoint2d rectMax, EdgeT waBlock, EdgeT wbBlock, EdgeT wcBlock, float zBlock, float invWBlock,
+	bool depthPasses)
+{
+	// clamp block rows to the rectangle, as the block may overhang it
+	int yMin = std::max(blockPos.y, rectMin.y);
+	int yMax = std::min(blockPos.y + BLOCK_SIZE - 1, rectMax.y);
+	int dy = yMin - blockPos.y;
+
+	const simd::vfloat zScale = simd::splat(float(ZBUFFMAX));
+	const simd::vfloat half = simd::splat(0.5f);
+	Varying fragment; // reused for every fragment, its attributes are overwritten in place
+	QuadRow<EdgeT> quadRow;
+	int written = 0;
+	for (int chunk = 0; chunk < BLOCK_SIZE; chunk += simd::WIDTH) {
+		int x0 = blockPos.x + chunk;
+		quadRow.x0 = x0;
+		// lanes within the rectangle
+		int columnMask = simd::lane_range(rectMin.x - x0, rectMax.x - x0);
+		if (columnMask == 0) continue;
 
+		// values at the first lane of the first row, and vectors of them across the lanes (the edge values only
+		// for 32 bit edge functions, as there is no 64 bit SIMD compare below SSE4.2)
+		EdgeT waRow = waBlock + setup.wa.stepX * chunk + setup.wa.stepY * dy;
+		EdgeT wbRow = wbBlock + setup.wb.stepX * chunk + setup.wb.stepY * dy;
+		EdgeT wcRow = wcBlock + setup.wc.stepX * chunk + setup.wc.stepY * dy;
+		float zRow = zBlock + setup.z.stepX * chunk + setup.z.stepY * dy;
+		float invWRow = invWBlock + setup.invW.stepX * chunk + setup.invW.stepY * dy;
+		simd::vint vwa, vwb, vwc;
+		if constexpr (std::is_same_v<EdgeT, int>) {
+			vwa = simd::add(simd::splat(waRow), simd::ramp(setup.wa.stepX));
+			vwb = simd::add(simd::splat(wbRow), simd::ramp(setup.wb.stepX));
+			vwc = simd::add(simd::splat(wcRow), simd::ramp(setup.wc.stepX));
+		}
+		simd::vfloat vz = simd::add(simd::splat(zRow), simd::ramp(setup.z.stepX));
+
+		for (int y = yMin; y <= yMax; y++) {
 			// TODO: top left rule so not double draw edges
-			if (wa >= 0 && wb >= 0 && wc >= 0) {
-				// check against zbuffer, only write if less than zbuffer, then update it
-				// note we can simply interpolate Z as normal here since we are not working with
-				// world space Z values, but rather the (mapped) NDC Z values
-				float ba = wa * normFactor;
-				float bb = wb * normFactor;
-				float bc = wc * normFactor;
-				float z = ba * a.gl_Position.z + bb * b.gl_Position.z + bc * c.gl_Position.z;
-				// TODO: ONLY lazy clip on z if near/far plane clipping was skipped, as it is wasted effort otherwise
-				// Late/lazy z clipping (reject if out of NDC bounds, unnecessary if near/far clipping has been done)
-				if (z < 0 || z > 1) return;
-				zbuffer_t z_fixed = zbuffer_t(z * ZBUFFMAX + 0.5f);
-				if (z_fixed < m_zbuffer[p.y * m_width + p.x]) {
-					m_zbuffer[p.y * m_width + p.x] = z_fixed;
-					// TODO: make interpolation automatic, i.e. automatically interpolate all
-					// fields except gl_Position rather than forcing user to provide interpolation function
+			// (sign bit of the OR is set iff any of the edge values is negative)
+			int mask = columnMask;
+			if constexpr (TestEdges && std::is_same_v<EdgeT, int>) {
+				mask &= ~simd::sign_mask(simd::bit_or(simd::bit_or(vwa, vwb), vwc));
+			}
+			else if constexpr (TestEdges) {
+				int covered = 0;
+				for (int lane = 0; lane < simd::WIDTH; lane++) {
+					EdgeT w = (waRow + setup.wa.stepX * lane) | (wbRow + setup.wb.stepX * lane) | (wcRow + setup.wc.stepX * lane);
+					covered |= int(w >= 0) << lane;
+				}
+				mask &= covered;
+			}
+
+			// check against zbuffer, only write if less than zbuffer, then update it (or, in the shading pass after a
+			// depth prepass, only keep fragments whose depth is the one already stored)
+			// note we can simply interpolate Z as normal here since we are not working with
+			// world space Z values, but rather the (mapped) NDC Z values
+			if (mask) {
+				simd::vint zFixed = simd::truncate(simd::add(simd::mul(vz, zScale), half));
+				if constexpr (Pass == RASTER_DEPTH_EQUAL) {
+					mask = simd::equal_u16(m_framebuffer.depth_span(x0, y), zFixed, mask);
+				}
+				else if (depthPasses) {
+					simd::store_u16(m_framebuffer.depth_span(x0, y), zFixed);
+				}
+				else {
+					mask = simd::less_store_u16(m_framebuffer.depth_span(x0, y), zFixed, mask);
+				}
+				written |= mask;
+			}
+
+			if constexpr (Pass == RASTER_VISIBILITY) {
+				while (mask) {
+					int lane = std::countr_zero(unsigned(mask));
+					mask &= mask - 1;
+					m_framebuffer.visibility_span(x0, y)[lane] = setup.id;
+				}
+			}
+			else if constexpr (Pass != RASTER_DEPTH) {
+				// this row is one half of a quad row, which is shaded once both halves are known. A half outside the
+				// rectangle has no fragments, its values are stepped from this row's
+				auto storeRow = [&](int row, int steps, int rowMask) {
+					quadRow.mask[row] = rowMask;
+					quadRow.wa[row] = waRow + setup.wa.stepY * steps;
+					quadRow.wb[row] = wbRow + setup.wb.stepY * steps;
+					quadRow.wc[row] = wcRow + setup.wc.stepY * steps;
+					quadRow.z[row] = zRow + setup.z.stepY * steps;
+					quadRow.invW[row] = invWRow + setup.invW.stepY * steps;
+				};
+				int row = y & 1;
+				storeRow(row, 0, mask);
+				if (row == 1 && y == yMin) {
+					storeRow(0, -1, 0);
+				}
+				if (row == 0 && y == yMax) {
+					storeRow(1, 1, 0);
+				}
+				if (row == 1 || y == yMax) {
+					quadRow.y = y & ~1;
+					if (quadRow.mask[0] | quadRow.mask[1]) {
+						shade_fragments(shaderProgram, setup, quadRow, fragment);
+					}
+				}
+			}
+
+			waRow += setup.wa.stepY;
+			wbRow += setup.wb.stepY;
+			wcRow += setup.wc.stepY;
+			zRow += setup.z.stepY;
+			invWRow += setup.invW.stepY;
+			if constexpr (std::is_same_v<EdgeT, int>) {
+				vwa = simd::add(vwa, simd::splat(setup.wa.stepY));
+				vwb = simd::add(vwb, simd::splat(setup.wb.stepY));
+				vwc = simd::add(vwc, simd::splat(setup.wc.stepY));
+			}
+			vz = simd::add(vz, simd::splat(setup.z.stepY));
+		}
+	}
+	return written != 0;
+}
+
+// Tightens the hierarchical z bounds of a block after a triangle with depths in [zMin, zMax] wrote to it. zMax
+// must only be below ZBUFFMAX if the triangle covered every pixel of the block (inside the image), as every
+// value in the block is then at most zMax
+template<typename Vertex, typename Varying>
+inline void Renderer<Vertex, Varying>::update_hierarchical_z(ipoint2d block, int zMin, int zMax)
+{
+	Framebuffer& fb = m_framebuffer;
+	int index = (block.y >> BLOCK_BITS) * fb.m_blocksX + (block.x >> BLOCK_BITS);
+	fb.m_blockMinZ[index] = zbuffer_t(std::clamp<int>(zMin, 0, fb.m_blockMinZ[index]));
+	if (zMax < fb.m_blockMaxZ[index]) {
+		fb.m_blockMaxZ[index] = zbuffer_t(std::max(zMax, 0));
+
+		// the tile's bound is the largest of its blocks'
+		constexpr int TILE_BLOCKS = TILE_SIZE / BLOCK_SIZE;
+		int tx = block.x >> TILE_BITS, ty = block.y >> TILE_BITS;
+		int bxEnd = std::min((tx + 1) * TILE_BLOCKS, fb.m_blocksX), byEnd = std::min((ty + 1) * TILE_BLOCKS, fb.m_blocksY);
+		zbuffer_t farthest = 0;
+		for (int by = ty * TILE_BLOCKS; by < byEnd; by++) {
+			for (int bx = tx * TILE_BLOCKS; bx < bxEnd; bx++) {
+				farthest = std::max(farthest, fb.m_blockMaxZ[by * fb.m_blocksX + bx]);
+			}
+		}
+		fb.m_tileMaxZ[ty * m_tilesX + tx] = farthest;
+	}
+}
+
+// Shades the pixels of one visibility buffer rectangle, each (if covered) by the triangle whose ID it holds, and
+// resets them to NO_TRIANGLE for the next draw. Edge, z and 1/w values are evaluated from the triangle's setup at
+// the pixel, so barycentrics are exactly those forward rendering would have used. Pixels are visited a quad row at
+// a time, and all pixels of one showing the same triangle are shaded together (as a batch if the program has a
+// batched fragment shader), with pixels of its quads showing other triangles as helpers
+template<typename Vertex, typename Varying>
+template<typename EdgeT, typename Program>
+inline void Renderer<Vertex, Varying>::resolve_visibility(Program& shaderProgram, const std::vector<const TriangleSetup<Varying, EdgeT>*>& triangles,
+	ipoint2d rectMin, ipoint2d rectMax)
+{
+	Varying fragment;
+	QuadRow<EdgeT> quadRow;
+	for (int y = rectMin.y & ~1; y <= rectMax.y; y += 2) {
+		quadRow.y = y;
+		int rowInRect[2] = { y >= rectMin.y, y + 1 <= rectMax.y };
+		for (int x0 = rectMin.x & ~(simd::WIDTH - 1); x0 <= rectMax.x; x0 += simd::WIDTH) {
+			quadRow.x0 = x0;
+			uint32_t* rows[2] = { m_framebuffer.visibility_span(x0, y), m_framebuffer.visibility_span(x0, y + 1) };
+			int columnMask = simd::lane_range(rectMin.x - x0, rectMax.x - x0);
+			int pending[2] = { 0, 0 };
+			for (int row = 0; row < 2; row++) {
+				if (!rowInRect[row]) continue;
+				for (int lane = 0; lane < simd::WIDTH; lane++) {
+					pending[row] |= int(rows[row][lane] != NO_TRIANGLE) << lane;
+				}
+				pending[row] &= columnMask;
+			}
+
+			while (pending[0] | pending[1]) {
+				int firstRow = pending[0] ? 0 : 1;
+				uint32_t id = rows[firstRow][std::countr_zero(unsigned(pending[firstRow]))];
+				const TriangleSetup<Varying, EdgeT>& setup = *triangles[id];
+				int dx = x0 - setup.origin.x;
+				for (int row = 0; row < 2; row++) {
+					int mask = 0;
+					for (int lane = 0; lane < simd::WIDTH; lane++) {
+						mask |= int(rows[row][lane] == id) << lane;
+					}
+					quadRow.mask[row] = mask & pending[row];
+					pending[row] &= ~mask;
+
+					int dy = y + row - setup.origin.y;
+					quadRow.wa[row] = setup.wa.origin + setup.wa.stepX * dx + setup.wa.stepY * dy;
+					quadRow.wb[row] = setup.wb.origin + setup.wb.stepX * dx + setup.wb.stepY * dy;
+					quadRow.wc[row] = setup.wc.origin + setup.wc.stepX * dx + setup.wc.stepY * dy;
+					quadRow.z[row] = setup.z.origin + setup.z.stepX * dx + setup.z.stepY * dy;
+					quadRow.invW[row] = setup.invW.origin + setup.invW.stepX * dx + setup.invW.stepY * dy;
+				}
+				shade_fragments(shaderProgram, setup, quadRow, fragment);
+			}
+
+			for (int row = 0; row < 2; row++) {
+				if (!rowInRect[row]) continue;
+				for (int lane = 0; lane < simd::WIDTH; lane++) {
+					if (columnMask & (1 << lane)) {
+						rows[row][lane] = NO_TRIANGLE;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Perspective correct barycentrics (ba, bb, bc) of the pixel lane pixels on from the first pixel of a row of a quad
+// row (lane may be outside the SIMD row, for helpers), returning 1/w there
+template<typename Vertex, typename Varying>
+template<typename EdgeT>
+inline float Renderer<Vertex, Varying>::barycentrics(const TriangleSetup<Varying, EdgeT>& setup, const QuadRow<EdgeT>& quadRow, int row, int lane,
+	float& ba, float& bb, float& bc)
+{
+	ba = (quadRow.wa[row] + setup.wa.stepX * lane) * setup.normFactor;
+	bb = (quadRow.wb[row] + setup.wb.stepX * lane) * setup.normFactor;
+	bc = (quadRow.wc[row] + setup.wc.stepX * lane) * setup.normFactor;
+	float invW = quadRow.invW[row] + setup.invW.stepX * lane;
 
 #ifndef DISABLE_PERSPECTIVE_CORRECTION
-					// perspective correct barycentrics before interpolating varyings
-					float w = ba * a.gl_Position.w + bb * b.gl_Position.w + bc * c.gl_Position.w;
-					ba *= ((1.f/w) * a.gl_Position.w);
-					bb *= ((1.f/w) * b.gl_Position.w);
-					bc *= ((1.f/w) * c.gl_Position.w);
+	// perspective correct barycentrics before interpolating varyings
+	float w = 1.f / invW;
+	ba *= (w * setup.a->gl_Position.w);
+	bb *= (w * setup.b->gl_Position.w);
+	bc *= (w * setup.c->gl_Position.w);
 #endif
+	return invW;
+}
 
-					Varying interpolated = shaderProgram.interpolate(a, b, c, ba, bb, bc);
-					glm::vec3 col = glm::clamp(shaderProgram.fragmentShader(interpolated), 0.f, 1.f);
-					col = col * glm::vec3(255) + glm::vec3(0.5); // convert from [0.f,1.f] colourspace to [0, 255] for TGAColor
-					m_image.set(p.x, p.y, TGAColor(col.x, col.y, col.z, 1));
+// Shades the fragments of a quad row: as batches if the program can, otherwise one at a time through fragment (whose
+// attributes are overwritten), or through whole quads if the program takes them
+template<typename Vertex, typename Varying>
+template<typename Program, typename EdgeT>
+inline void Renderer<Vertex, Varying>::shade_fragments(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup, const QuadRow<EdgeT>& quadRow,
+	Varying& fragment)
+{
+	const Varying& a = *setup.a;
+	const Varying& b = *setup.b;
+	const Varying& c = *setup.c;
+	if constexpr (BatchedFragmentShader<Program, Varying, simd::WIDTH>) {
+		shade_batch(shaderProgram, setup, quadRow);
+	}
+	else if constexpr (QuadFragmentShader<Program, Varying>) {
+		// quads are aligned to even x, so with 1 lane rows a quad's other column lies in the neighbouring row
+		constexpr int COLUMNS = std::max(simd::WIDTH, 2);
+		int first = quadRow.x0 & 1; // quad column of lane 0
+		FragmentQuad<Varying> quad;
+		for (int column = 0; column < COLUMNS; column += 2) {
+			quad.mask = ((quadRow.mask[0] << first) >> column & 3) | (((quadRow.mask[1] << first) >> column & 3) << 2);
+			if (!quad.mask) continue;
+			for (int i = 0; i < 4; i++) {
+				int row = i >> 1;
+				int lane = column + (i & 1) - first;
+				float ba, bb, bc;
+				float invW = barycentrics(setup, quadRow, row, lane, ba, bb, bc);
+				// a helper's 1/w is extrapolated, so can even be negative where a triangle crosses the w = 0 plane
+				if (!(quad.mask & (1 << i)) && !(invW > 0.f)) {
+					ba = bb = bc = 1.f / 3.f;
 				}
+				interpolate_varying(shaderProgram, a, b, c, ba, bb, bc, quad.fragments[i]);
+				quad.fragments[i].gl_Position = glm::vec4(quadRow.x0 + lane + 0.5f, quadRow.y + row + 0.5f,
+					quadRow.z[row] + setup.z.stepX * lane, invW);
+			}
+			for (int fragments = quad.mask; fragments; fragments &= fragments - 1) {
+				quad.index = std::countr_zero(unsigned(fragments));
+				m_framebuffer.set(quadRow.x0 - first + column + (quad.index & 1), quadRow.y + (quad.index >> 1), shaderProgram.fragmentShader(quad));
+			}
+		}
+	}
+	else {
+		// no derivatives needed, so no helpers either
+		for (int row = 0; row < 2; row++) {
+			int mask = quadRow.mask[row];
+			while (mask) {
+				int lane = std::countr_zero(unsigned(mask));
+				mask &= mask - 1;
+
+				float ba, bb, bc;
+				float invW = barycentrics(setup, quadRow, row, lane, ba, bb, bc);
+				// fragment's gl_Position is its window position (pixel center, depth and 1/w) like gl_FragCoord
+				interpolate_varying(shaderProgram, a, b, c, ba, bb, bc, fragment);
+				fragment.gl_Position = glm::vec4(quadRow.x0 + lane + 0.5f, quadRow.y + row + 0.5f, quadRow.z[row] + setup.z.stepX * lane, invW);
+				m_framebuffer.set(quadRow.x0 + lane, quadRow.y + row, shaderProgram.fragmentShader(fragment));
+			}
+		}
+	}
+}
+
+// Shades the fragments of a quad row with the program's batched fragment shader, as a batch per row. The attributes
+// of both rows (across whole quads) are computed first, in loops over all lanes at once that the compiler can
+// vectorize, then each row's batch takes its attributes and their differences across the quads from them
+template<typename Vertex, typename Varying>
+template<typename Program, typename EdgeT>
+inline void Renderer<Vertex, Varying>::shade_batch(Program& shaderProgram, const TriangleSetup<Varying, EdgeT>& setup, const QuadRow<EdgeT>& quadRow)
+{
+	constexpr int WIDTH = simd::WIDTH;
+	constexpr int COLUMNS = std::max(WIDTH, 2); // whole quads, see shade_fragments
+	constexpr int ATTRIBUTES = FragmentBatch<Varying, WIDTH>::ATTRIBUTES;
+	int first = quadRow.x0 & 1;
+	// columns of quads with any fragment, whose other pixels are helpers
+	int covered = (quadRow.mask[0] | quadRow.mask[1]) << first;
+	int quads = (covered | covered >> 1) & 0x55;
+	int live = quads | quads << 1;
+
+	float ba[2][COLUMNS], bb[2][COLUMNS], bc[2][COLUMNS];
+	for (int row = 0; row < 2; row++) {
+		for (int column = 0; column < COLUMNS; column++) {
+			float invW = barycentrics(setup, quadRow, row, column - first, ba[row][column], bb[row][column], bc[row][column]);
+			// pixels outside any quad with fragments may lie anywhere outside the triangle, where the varyings (and
+			// even 1/w) can take any value, so they are given the triangle's centroid instead, as are helpers
+			// with an extrapolated 1/w that is not positive
+			bool fragment = ((quadRow.mask[row] << first) >> column) & 1;
+			if (!fragment && (!((live >> column) & 1) || !(invW > 0.f))) {
+				ba[row][column] = bb[row][column] = bc[row][column] = 1.f / 3.f;
+			}
+		}
+	}
+
+	const float* va = VaryingAttributes<Varying>::get(*setup.a);
+	const float* vb = VaryingAttributes<Varying>::get(*setup.b);
+	const float* vc = VaryingAttributes<Varying>::get(*setup.c);
+	float attributes[2][ATTRIBUTES][COLUMNS];
+	for (int row = 0; row < 2; row++) {
+		for (int i = 0; i < VaryingAttributes<Varying>::COUNT; i++) {
+			for (int column = 0; column < COLUMNS; column++) {
+				attributes[row][i][column] = ba[row][column] * va[i] + bb[row][column] * vb[i] + bc[row][column] * vc[i];
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	FragmentBatch<Varying, WIDTH> batch;
+	for (int row = 0; row < 2; row++) {
+		int mask = quadRow.mask[row];
+		if (!mask) continue;
+		int y = quadRow.y + row;
+		batch.mask = mask;
+		for (int lane = 0; lane < WIDTH; lane++) {
+			batch.position[0][lane] = quadRow.x0 + lane + 0.5f;
+			batch.position[1][lane] = y + 0.5f;
+			batch.position[2][lane] = quadRow.z[row] + setup.z.stepX * lane;
+			batch.position[3][lane] = quadRow.invW[row] + setup.invW.stepX * lane;
+		}
+		for (int i = 0; i < VaryingAttributes<Varying>::COUNT; i++) {
+			for (int lane = 0; lane < WIDTH; lane++) {
+				int column = lane + first;
+				batch.attributes[i][lane] = attributes[row][i][column];
+				batch.dFdx[i][lane] = attributes[row][i][column | 1] - attributes[row][i][column & ~1];
+				batch.dFdy[i][lane] = attributes[1][i][column] - attributes[0][i][column];
+			}
+		}
+
+		ColourBatch<WIDTH> colour;
+		shaderProgram.fragmentShader(batch, colour);
+		m_framebuffer.set_row(quadRow.x0, y, simd::pack_unorm8(simd::load(colour.r), simd::load(colour.g), simd::load(colour.b)), mask);
+	}
+}
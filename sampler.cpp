@@ -1,101 +1,628 @@
 #include "sampler.h"
+#include "textureRegistry.h"
+#include "simd.h"
 #include <algorithm>
-#include <math.h>
 #include <cmath>
+#include <cstring>
+#include <climits>
+#include <type_traits>
 #include <glm/glm.hpp>
 
-const glm::vec3 Sampler::operator()(float x, float y)
-{
-    // if sampling coords are out of bounds ([0,1]) then wrap appropriately
-    if (x > 1.f || x < 0.f || y > 1.f || y < 0.f) {
-        switch (m_wrapMode) {
+namespace {
+    // 8 bit formats are filtered in fixed point in their own units of [0, 255], R32F in floats
+    template <texelFormat Format>
+    using Channel = std::conditional_t<Format == R32F, float, int>;
+
+    // from Channel units to the sampler's results
+    template <texelFormat Format>
+    constexpr float TEXEL_SCALE = Format == R32F ? 1.f : 1.f / 255.f;
+
+    // Reads the first N channels of a texel, filling in channels the format lacks as described for Sampler
+    template <texelFormat Format, int N>
+    inline void read_texel(const uint8_t* texel, Channel<Format>* out)
+    {
+        if constexpr (Format == R32F) {
+            float value;
+            memcpy(&value, texel, sizeof(float));
+            for (int c = 0; c < N; c++) out[c] = c < 3 ? value : 1.f;
+        }
+        else {
+            for (int c = 0; c < N; c++) {
+                if constexpr (Format == R8) out[c] = c < 3 ? texel[0] : 255;
+                else if constexpr (Format == RG8) out[c] = c < 2 ? texel[c] : c == 2 ? 0 : 255;
+                else out[c] = texel[c];
+            }
+        }
+    }
+
+    // log2 to within 0.005, from the exponent and a quadratic fit of the mantissa: plenty for choosing mip levels,
+    // and cheap on SIMD lanes too. 0 gives about -127
+    inline float fast_log2(float x)
+    {
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(float));
+        float exponent = float(int(bits >> 23) - 127);
+        uint32_t mantissaBits = (bits & 0x7FFFFF) | 0x3F800000;
+        float m;
+        memcpy(&m, &mantissaBits, sizeof(float));
+        return exponent + ((-0.34484843f * m + 2.02466578f) * m - 1.67487759f);
+    }
+
+    // Wraps a coordinate outside [0, 1] into it, returning false if the sample is the fill colour instead. REPEAT
+    // keeps 1.0 as it is (rather than wrapping it to 0)
+    template <wrappingMode Wrap>
+    inline bool wrap(float& x)
+    {
+        if constexpr (Wrap == CLAMPTOEDGE) {
+            x = std::min(1.f, std::max(0.f, x));
+        }
+        else if constexpr (Wrap == REPEAT) {
+            if (x < 0.f || x > 1.f) x -= std::floor(x);
+        }
+        else if constexpr (Wrap == MIRROR) {
+            x = std::fabs(std::min(2.f, std::max(-1.f, x)));
+            x = std::min(x, 2.f - x);
+        }
+        else {
+            return x >= 0.f && x <= 1.f;
+        }
+        return true;
+    }
+
+    // The bilinear footprint of x (in [0, 1]) across a level size texels wide, in 8.8 fixed point: its first texel,
+    // and the weight (0 to 256) of the second
+    inline void footprint(float x, int size, int& first, int& weight)
+    {
+        float end = float((size - 1) << 8);
+        int position = int(std::min(end, std::max(0.f, x * end)));
+        first = position >> 8;
+        weight = position & 255;
+        // sampling at 1.0 the second texel would be out of bounds, so the footprint ends at the last texel instead
+        if (first == size - 1 && first > 0) {
+            first--;
+            weight = 256;
+        }
+    }
+
+    template <texelFormat Format, int N>
+    inline void nearest(const Texture& texture, float x, float y, Channel<Format>* out)
+    {
+        // the position is clamped to the level (as in footprint) before converting, so any coordinate stays in it
+        float end_x = float(texture.get_width(0) - 1), end_y = float(texture.get_height(0) - 1);
+        int x_near = int(std::min(end_x, std::max(0.f, x * end_x)) + 0.5f);
+        int y_near = int(std::min(end_y, std::max(0.f, y * end_y)) + 0.5f);
+        read_texel<Format, N>(texture.texel(x_near, y_near, 0), out);
+    }
+
+    template <texelFormat Format, int N>
+    inline void bilinear(const Texture& texture, float x, float y, int level, Channel<Format>* out)
+    {
+        int width = texture.get_width(level), height = texture.get_height(level);
+        int x1, fx, y1, fy;
+        footprint(x, width, x1, fx);
+        footprint(y, height, y1, fy);
+        // a level 1 texel wide or high (where the second texel gets no weight) reads its edge twice
+        int x2 = std::min(x1 + 1, width - 1), y2 = std::min(y1 + 1, height - 1);
+
+        Channel<Format> c11[N], c12[N], c21[N], c22[N];
+        read_texel<Format, N>(texture.texel(x1, y1, level), c11);
+        read_texel<Format, N>(texture.texel(x1, y2, level), c12);
+        read_texel<Format, N>(texture.texel(x2, y1, level), c21);
+        read_texel<Format, N>(texture.texel(x2, y2, level), c22);
+
+        for (int c = 0; c < N; c++) {
+            if constexpr (Format == R32F) {
+                float wx1 = float(256 - fx) * (1.f / 256), wx2 = float(fx) * (1.f / 256);
+                float wy1 = float(256 - fy) * (1.f / 256), wy2 = float(fy) * (1.f / 256);
+                out[c] = (c11[c] * wx1 + c21[c] * wx2) * wy1 + (c12[c] * wx1 + c22[c] * wx2) * wy2;
+            }
+            else {
+                // weights sum to 65536, so the result rounds back to 8 bits
+                int top = c11[c] * (256 - fx) + c21[c] * fx;
+                int bottom = c12[c] * (256 - fx) + c22[c] * fx;
+                out[c] = (top * (256 - fy) + bottom * fy + 32768) >> 16;
+            }
+        }
+    }
+
+    template <texelFormat Format, int N>
+    inline void trilinear(const Texture& texture, float x, float y, float lod, Channel<Format>* out)
+    {
+        // levels of detail below 0 (magnified, or NaN) take the base level, above the last level the last level
+        int lastLevel = texture.get_levels() - 1;
+        float clamped = std::min(float(lastLevel), std::max(0.f, lod));
+        int level = int(clamped);
+        // the weight of the coarser level, in 8 bits
+        int blend = int((clamped - float(level)) * 256.f);
+        bilinear<Format, N>(texture, x, y, level, out);
+        if (blend == 0) return;
+
+        Channel<Format> coarser[N];
+        bilinear<Format, N>(texture, x, y, level + 1, coarser);
+        for (int c = 0; c < N; c++) {
+            if constexpr (Format == R32F) out[c] = out[c] + (coarser[c] - out[c]) * (float(blend) * (1.f / 256));
+            else out[c] = (out[c] * (256 - blend) + coarser[c] * blend + 128) >> 8;
+        }
+    }
+
+    template <texelFormat Format, samplingMode Sampling, wrappingMode Wrap, int N>
+    void sample_texel(const Texture& texture, const glm::vec4& fillColor, float x, float y, float lod, float* out)
+    {
+        if (!wrap<Wrap>(x) || !wrap<Wrap>(y)) {
+            for (int c = 0; c < N; c++) out[c] = fillColor[c];
+            return;
+        }
+        Channel<Format> texel[N];
+        if constexpr (Sampling == NEAREST) nearest<Format, N>(texture, x, y, texel);
+        else if constexpr (Sampling == BILINEAR) bilinear<Format, N>(texture, x, y, 0, texel);
+        else trilinear<Format, N>(texture, x, y, lod, texel);
+        for (int c = 0; c < N; c++) {
+            out[c] = texel[c] * TEXEL_SCALE<Format>;
+        }
+    }
+
+    // The level of detail is log2 of the larger of the lengths, in texels, of the two derivatives (very negative,
+    // i.e. the base level, for zero derivatives)
+    inline float level_of_detail(const Texture& texture, glm::vec2 dx, glm::vec2 dy)
+    {
+        float width = float(texture.get_width(0)), height = float(texture.get_height(0));
+        float xX = dx.x * width, yX = dx.y * height, xY = dy.x * width, yY = dy.y * height;
+        return 0.5f * fast_log2(std::max(xX * xX + yX * yX, xY * xY + yY * yY));
+    }
+
+    // sample_texel at the level of detail of the derivatives of the coordinates, which only TRILINEAR computes
+    template <texelFormat Format, samplingMode Sampling, wrappingMode Wrap, int N>
+    void sample_texel_gradient(const Texture& texture, const glm::vec4& fillColor, float x, float y, glm::vec2 dx, glm::vec2 dy, float* out)
+    {
+        float lod = 0.f;
+        if constexpr (Sampling == TRILINEAR) {
+            lod = level_of_detail(texture, dx, dy);
+        }
+        sample_texel<Format, Sampling, Wrap, N>(texture, fillColor, x, y, lod, out);
+    }
+
+#if defined(SIMD_AVX2)
+    // The batched kernels, which follow the ones above step for step on 8 lanes, so give the same results. Texels are
+    // fetched with 32 bit gathers at byte offsets into the texture's data (which has the slack past its end to allow
+    // this for smaller texels), so it must be under 2GB
+    template <texelFormat Format>
+    struct ChannelVectorOf { typedef __m256i type; };
+    template <>
+    struct ChannelVectorOf<R32F> { typedef __m256 type; };
+    template <texelFormat Format>
+    using ChannelVector = typename ChannelVectorOf<Format>::type;
+
+    inline __m256 fast_log2(__m256 x)
+    {
+        __m256i bits = _mm256_castps_si256(x);
+        __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+        __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7FFFFF)), _mm256_set1_epi32(0x3F800000)));
+        __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-0.34484843f), m), _mm256_set1_ps(2.02466578f));
+        return _mm256_add_ps(exponent, _mm256_sub_ps(_mm256_mul_ps(p, m), _mm256_set1_ps(1.67487759f)));
+    }
+
+    // wrap, accumulating the lanes that are the fill colour in outside
+    template <wrappingMode Wrap>
+    inline __m256 wrap(__m256 x, __m256& outside)
+    {
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+        if constexpr (Wrap == CLAMPTOEDGE) {
+            return _mm256_min_ps(_mm256_max_ps(x, zero), one);
+        }
+        else if constexpr (Wrap == REPEAT) {
+            __m256 out = _mm256_or_ps(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), _mm256_cmp_ps(x, one, _CMP_GT_OQ));
+            return _mm256_blendv_ps(x, _mm256_sub_ps(x, _mm256_floor_ps(x)), out);
+        }
+        else if constexpr (Wrap == MIRROR) {
+            x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-1.f)), _mm256_set1_ps(2.f));
+            x = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+            return _mm256_min_ps(_mm256_sub_ps(_mm256_set1_ps(2.f), x), x);
+        }
+        else {
+            outside = _mm256_or_ps(outside, _mm256_or_ps(_mm256_cmp_ps(x, zero, _CMP_NGE_UQ), _mm256_cmp_ps(x, one, _CMP_NLE_UQ)));
+            return x;
+        }
+    }
+
+    // Mip levels, per lane
+    struct LevelVectors {
+        __m256i width, height, blocksX, offset;
+    };
+
+    inline LevelVectors level_vectors(const Texture::MipLevel& level)
+    {
+        return LevelVectors{ _mm256_set1_epi32(level.width), _mm256_set1_epi32(level.height), _mm256_set1_epi32(level.blocksX), _mm256_set1_epi32(int(level.offset)) };
+    }
+
+    inline LevelVectors level_vectors(const Texture& texture, __m256i levels)
+    {
+        alignas(32) int level[8], width[8], height[8], blocksX[8], offset[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(level), levels);
+        for (int lane = 0; lane < 8; lane++) {
+            const Texture::MipLevel& mip = texture.get_level(level[lane]);
+            width[lane] = mip.width;
+            height[lane] = mip.height;
+            blocksX[lane] = mip.blocksX;
+            offset[lane] = int(mip.offset);
+        }
+        return LevelVectors{ _mm256_load_si256(reinterpret_cast<const __m256i*>(width)), _mm256_load_si256(reinterpret_cast<const __m256i*>(height)),
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(blocksX)), _mm256_load_si256(reinterpret_cast<const __m256i*>(offset)) };
+    }
+
+    inline void footprint(__m256 x, __m256i size, __m256i& first, __m256i& weight)
+    {
+        __m256i last = _mm256_sub_epi32(size, _mm256_set1_epi32(1));
+        __m256 end = _mm256_cvtepi32_ps(_mm256_slli_epi32(last, 8));
+        __m256i position = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(x, end), _mm256_setzero_ps()), end));
+        first = _mm256_srai_epi32(position, 8);
+        weight = _mm256_and_si256(position, _mm256_set1_epi32(255));
+        // all bits set in the lanes at the end
+        __m256i atEnd = _mm256_and_si256(_mm256_cmpeq_epi32(first, last), _mm256_cmpgt_epi32(first, _mm256_setzero_si256()));
+        first = _mm256_add_epi32(first, atEnd);
+        weight = _mm256_blendv_epi8(weight, _mm256_set1_epi32(256), atEnd);
+    }
+
+    // byte offsets of texels (x, y) in the texture's data, as Texture::texel
+    template <texelFormat Format>
+    inline __m256i texel_offsets(const LevelVectors& level, texelLayout layout, __m256i x, __m256i y)
+    {
+        __m256i index;
+        if (layout == BLOCKED) {
+            const int bits = Texture::TEXEL_BLOCK_BITS;
+            const __m256i mask = _mm256_set1_epi32(Texture::TEXEL_BLOCK_SIZE - 1);
+            __m256i block = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(y, bits), level.blocksX), _mm256_srai_epi32(x, bits));
+            __m256i inBlock = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(y, mask), bits), _mm256_and_si256(x, mask));
+            index = _mm256_add_epi32(level.offset, _mm256_add_epi32(_mm256_slli_epi32(block, 2 * bits), inBlock));
+        }
+        else {
+            index = _mm256_add_epi32(level.offset, _mm256_add_epi32(_mm256_mullo_epi32(y, level.width), x));
+        }
+        constexpr int shift = Format == R8 ? 0 : Format == RG8 ? 1 : 2;
+        return _mm256_slli_epi32(index, shift);
+    }
+
+    template <texelFormat Format, int N>
+    inline void read_texels(const uint8_t* data, __m256i offsets, ChannelVector<Format>* out)
+    {
+        __m256i texels = _mm256_i32gather_epi32(reinterpret_cast<const int*>(data), offsets, 1);
+        const __m256i byte = _mm256_set1_epi32(255);
+        for (int c = 0; c < N; c++) {
+            if constexpr (Format == R32F) {
+                out[c] = c < 3 ? _mm256_castsi256_ps(texels) : _mm256_set1_ps(1.f);
+            }
+            else {
+                // the gather reads whole words, so bytes past the texel are masked off
+                __m256i channel = _mm256_and_si256(_mm256_srlv_epi32(texels, _mm256_set1_epi32(8 * c)), byte);
+                if constexpr (Format == R8) out[c] = c < 3 ? _mm256_and_si256(texels, byte) : byte;
+                else if constexpr (Format == RG8) out[c] = c < 2 ? channel : c == 2 ? _mm256_setzero_si256() : byte;
+                else out[c] = channel;
+            }
+        }
+    }
+
+    template <texelFormat Format, int N>
+    inline void nearest(const Texture& texture, __m256 x, __m256 y, ChannelVector<Format>* out)
+    {
+        LevelVectors level = level_vectors(texture.get_level(0));
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256 zero = _mm256_setzero_ps(), half = _mm256_set1_ps(0.5f);
+        // FILL lanes outside the texture arrive here unwrapped, so clamping the position is what keeps them in it
+        __m256 end_x = _mm256_cvtepi32_ps(_mm256_sub_epi32(level.width, one)), end_y = _mm256_cvtepi32_ps(_mm256_sub_epi32(level.height, one));
+        __m256i x_near = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(x, end_x), zero), end_x), half));
+        __m256i y_near = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(y, end_y), zero), end_y), half));
+        read_texels<Format, N>(texture.get_data(), texel_offsets<Format>(level, texture.get_layout(), x_near, y_near), out);
+    }
+
+    template <texelFormat Format, int N>
+    inline void bilinear(const Texture& texture, const LevelVectors& level, __m256 x, __m256 y, ChannelVector<Format>* out)
+    {
+        __m256i x1, fx, y1, fy;
+        footprint(x, level.width, x1, fx);
+        footprint(y, level.height, y1, fy);
+        const __m256i one = _mm256_set1_epi32(1);
+        __m256i x2 = _mm256_min_epi32(_mm256_add_epi32(x1, one), _mm256_sub_epi32(level.width, one));
+        __m256i y2 = _mm256_min_epi32(_mm256_add_epi32(y1, one), _mm256_sub_epi32(level.height, one));
+
+        ChannelVector<Format> c11[N], c12[N], c21[N], c22[N];
+        const uint8_t* data = texture.get_data();
+        texelLayout layout = texture.get_layout();
+        read_texels<Format, N>(data, texel_offsets<Format>(level, layout, x1, y1), c11);
+        read_texels<Format, N>(data, texel_offsets<Format>(level, layout, x1, y2), c12);
+        read_texels<Format, N>(data, texel_offsets<Format>(level, layout, x2, y1), c21);
+        read_texels<Format, N>(data, texel_offsets<Format>(level, layout, x2, y2), c22);
+
+        const __m256i full = _mm256_set1_epi32(256);
+        __m256i fx1 = _mm256_sub_epi32(full, fx), fy1 = _mm256_sub_epi32(full, fy);
+        for (int c = 0; c < N; c++) {
+            if constexpr (Format == R32F) {
+                const __m256 scale = _mm256_set1_ps(1.f / 256);
+                __m256 wx1 = _mm256_mul_ps(_mm256_cvtepi32_ps(fx1), scale), wx2 = _mm256_mul_ps(_mm256_cvtepi32_ps(fx), scale);
+                __m256 wy1 = _mm256_mul_ps(_mm256_cvtepi32_ps(fy1), scale), wy2 = _mm256_mul_ps(_mm256_cvtepi32_ps(fy), scale);
+                __m256 top = _mm256_add_ps(_mm256_mul_ps(c11[c], wx1), _mm256_mul_ps(c21[c], wx2));
+                __m256 bottom = _mm256_add_ps(_mm256_mul_ps(c12[c], wx1), _mm256_mul_ps(c22[c], wx2));
+                out[c] = _mm256_add_ps(_mm256_mul_ps(top, wy1), _mm256_mul_ps(bottom, wy2));
+            }
+            else {
+                __m256i top = _mm256_add_epi32(_mm256_mullo_epi32(c11[c], fx1), _mm256_mullo_epi32(c21[c], fx));
+                __m256i bottom = _mm256_add_epi32(_mm256_mullo_epi32(c12[c], fx1), _mm256_mullo_epi32(c22[c], fx));
+                __m256i sum = _mm256_add_epi32(_mm256_mullo_epi32(top, fy1), _mm256_mullo_epi32(bottom, fy));
+                out[c] = _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(32768)), 16);
+            }
+        }
+    }
+
+    template <texelFormat Format, int N>
+    inline void trilinear(const Texture& texture, __m256 x, __m256 y, __m256 lod, ChannelVector<Format>* out)
+    {
+        __m256i lastLevel = _mm256_set1_epi32(texture.get_levels() - 1);
+        __m256 clamped = _mm256_min_ps(_mm256_max_ps(lod, _mm256_setzero_ps()), _mm256_cvtepi32_ps(lastLevel));
+        __m256i level = _mm256_cvttps_epi32(clamped);
+        __m256i blend = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(clamped, _mm256_cvtepi32_ps(level)), _mm256_set1_ps(256.f)));
+        bilinear<Format, N>(texture, level_vectors(texture, level), x, y, out);
+        if (_mm256_testz_si256(blend, blend)) return;
+
+        // lanes at the last level have no weight for the next one, which is only clamped to keep it in the chain
+        ChannelVector<Format> coarser[N];
+        bilinear<Format, N>(texture, level_vectors(texture, _mm256_min_epi32(_mm256_add_epi32(level, _mm256_set1_epi32(1)), lastLevel)), x, y, coarser);
+        for (int c = 0; c < N; c++) {
+            if constexpr (Format == R32F) {
+                __m256 weight = _mm256_mul_ps(_mm256_cvtepi32_ps(blend), _mm256_set1_ps(1.f / 256));
+                out[c] = _mm256_add_ps(out[c], _mm256_mul_ps(_mm256_sub_ps(coarser[c], out[c]), weight));
+            }
+            else {
+                __m256i sum = _mm256_add_epi32(_mm256_mullo_epi32(out[c], _mm256_sub_epi32(_mm256_set1_epi32(256), blend)), _mm256_mullo_epi32(coarser[c], blend));
+                out[c] = _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(128)), 8);
+            }
+        }
+    }
+
+    // level_of_detail on 8 lanes
+    inline __m256 level_of_detail(const Texture& texture, const float* dxdX, const float* dydX, const float* dxdY, const float* dydY)
+    {
+        __m256 width = _mm256_set1_ps(float(texture.get_width(0))), height = _mm256_set1_ps(float(texture.get_height(0)));
+        __m256 xX = _mm256_mul_ps(_mm256_loadu_ps(dxdX), width), yX = _mm256_mul_ps(_mm256_loadu_ps(dydX), height);
+        __m256 xY = _mm256_mul_ps(_mm256_loadu_ps(dxdY), width), yY = _mm256_mul_ps(_mm256_loadu_ps(dydY), height);
+        __m256 lengthX = _mm256_add_ps(_mm256_mul_ps(xX, xX), _mm256_mul_ps(yX, yX));
+        __m256 lengthY = _mm256_add_ps(_mm256_mul_ps(xY, xY), _mm256_mul_ps(yY, yY));
+        return _mm256_mul_ps(_mm256_set1_ps(0.5f), fast_log2(_mm256_max_ps(lengthY, lengthX)));
+    }
+
+    template <texelFormat Format, samplingMode Sampling, wrappingMode Wrap, int N>
+    void sample_texels(const Texture& texture, const glm::vec4& fillColor, const float* xs, const float* ys,
+        const float* dxdX, const float* dydX, const float* dxdY, const float* dydY, float* out)
+    {
+        __m256 outside = _mm256_setzero_ps();
+        __m256 x = wrap<Wrap>(_mm256_loadu_ps(xs), outside);
+        __m256 y = wrap<Wrap>(_mm256_loadu_ps(ys), outside);
+        ChannelVector<Format> texels[N];
+        if constexpr (Sampling == NEAREST) nearest<Format, N>(texture, x, y, texels);
+        else if constexpr (Sampling == BILINEAR) bilinear<Format, N>(texture, level_vectors(texture.get_level(0)), x, y, texels);
+        else trilinear<Format, N>(texture, x, y, level_of_detail(texture, dxdX, dydX, dxdY, dydY), texels);
+        for (int c = 0; c < N; c++) {
+            __m256 result;
+            if constexpr (Format == R32F) result = texels[c];
+            else result = _mm256_mul_ps(_mm256_cvtepi32_ps(texels[c]), _mm256_set1_ps(TEXEL_SCALE<Format>));
+            if constexpr (Wrap == FILL) result = _mm256_blendv_ps(result, _mm256_set1_ps(fillColor[c]), outside);
+            _mm256_storeu_ps(out + 8 * c, result);
+        }
+    }
+#endif
+
+    typedef void (*SampleKernel)(const Texture&, const glm::vec4&, float, float, glm::vec2, glm::vec2, float*);
+    typedef void (*LodKernel)(const Texture&, const glm::vec4&, float, float, float, float*);
+    typedef void (*BatchKernel)(const Texture&, const glm::vec4&, const float*, const float*, const float*, const float*, const float*, const float*, float*);
+
+    // The kernels for a format, modes and channel count
+    struct Kernels {
+        SampleKernel kernel;
+        LodKernel lodKernel;
+        BatchKernel batchKernel;
+    };
+
+    // Turn the run time modes and format into the template arguments of the kernels, one at a time
+    template <texelFormat Format, samplingMode Sampling, wrappingMode Wrap, int N>
+    void select_kernel(Kernels& kernels)
+    {
+        kernels.kernel = &sample_texel_gradient<Format, Sampling, Wrap, N>;
+        kernels.lodKernel = &sample_texel<Format, Sampling, Wrap, N>;
+#if defined(SIMD_AVX2)
+        kernels.batchKernel = &sample_texels<Format, Sampling, Wrap, N>;
+#else
+        kernels.batchKernel = nullptr;
+#endif
+    }
+
+    template <texelFormat Format, samplingMode Sampling, int N>
+    void select_wrap(wrappingMode wrapping, Kernels& kernels)
+    {
+        switch (wrapping) {
             case CLAMPTOEDGE:
-                x = std::clamp(x, 0.0f, 1.0f);
-                y = std::clamp(y, 0.0f, 1.0f);
+                select_kernel<Format, Sampling, CLAMPTOEDGE, N>(kernels);
                 break;
             case REPEAT:
-                x = fmod(x, 1.f);
-                x += (x < 0 ? 1.f : 0.f);
-                y = fmod(y, 1.f);
-                y += (y < 0 ? 1.f : 0.f);
+                select_kernel<Format, Sampling, REPEAT, N>(kernels);
                 break;
             case MIRROR:
-                x = std::clamp(x, -1.0f, 2.0f);
-                if (x < 0) x *= -1;
-                if (x > 1) x = 2 - x;
-                y = std::clamp(y, -1.0f, 2.0f);
-                if (y < 0) y *= -1;
-                if (y > 1) y = 2 - y;
+                select_kernel<Format, Sampling, MIRROR, N>(kernels);
                 break;
             case FILL:
-                return m_fillColor;
+                select_kernel<Format, Sampling, FILL, N>(kernels);
                 break;
         }
     }
 
-    // now sample from the texture appropriately
-    switch (m_sampleMode) {
-        case NEAREST: {
-            int x_near = std::roundf(x * (m_texture.get_width() - 1));
-            int y_near = std::roundf(y * (m_texture.get_height() - 1));
-            RGB sample = m_texture(x_near, y_near);
-            return glm::vec3(sample.r / 255.f, sample.g / 255.f, sample.b / 255.f);
+    template <texelFormat Format, int N>
+    void select_sampling(samplingMode sampling, wrappingMode wrapping, Kernels& kernels)
+    {
+        switch (sampling) {
+            case NEAREST:
+                select_wrap<Format, NEAREST, N>(wrapping, kernels);
+                break;
+            case BILINEAR:
+                select_wrap<Format, BILINEAR, N>(wrapping, kernels);
+                break;
+            case TRILINEAR:
+                select_wrap<Format, TRILINEAR, N>(wrapping, kernels);
+                break;
         }
-        case BILINEAR: {
-            float x_sample = x * (m_texture.get_width() - 1);
-            float y_sample = y * (m_texture.get_height() - 1);
+    }
 
-            int x1 = std::floorf(x_sample);
-            // minor correction needed for sampling at 1.0, as then the upper sample point is out of bounds
-            x1 -= (x1 == m_texture.get_width() - 1) ? 1 : 0;
-            int x2 = x1 + 1;
+    template <int N>
+    void select_format(texelFormat format, samplingMode sampling, wrappingMode wrapping, Kernels& kernels)
+    {
+        switch (format) {
+            case R8:
+                select_sampling<R8, N>(sampling, wrapping, kernels);
+                break;
+            case RG8:
+                select_sampling<RG8, N>(sampling, wrapping, kernels);
+                break;
+            case R32F:
+                select_sampling<R32F, N>(sampling, wrapping, kernels);
+                break;
+            default:
+                select_sampling<RGBA8, N>(sampling, wrapping, kernels);
+                break;
+        }
+    }
+}
 
-            int y1 = std::floorf(y_sample);
-            // minor correction needed for sampling at 1.0, as then the upper sample point is out of bounds
-            y1 -= (y1 == m_texture.get_height() - 1) ? 1 : 0;
-            int y2 = y1 + 1;
+const glm::vec3 Sampler::operator()(float x, float y)
+{
+    return sample<3>(x, y);
+}
 
+const glm::vec3 Sampler::operator()(float x, float y, glm::vec2 dx, glm::vec2 dy)
+{
+    return sample<3>(x, y, dx, dy);
+}
 
-            // sample texture at 4 corners
-            const RGB c11 = m_texture(x1, y1);
-            const RGB c12 = m_texture(x1, y2);
-            const RGB c21 = m_texture(x2, y1);
-            const RGB c22 = m_texture(x2, y2);
+const glm::vec3 Sampler::sampleLod(float x, float y, float lod)
+{
+    float out[3];
+    m_lodKernel(*m_texture, m_fillColor, x, y, lod, out);
+    return glm::vec3(out[0], out[1], out[2]);
+}
 
-            // compute weights for bilinear interpolation
-            float q11 = (x2 - x_sample) * (y2 - y_sample);
-            float q12 = (x2 - x_sample) * (y_sample - y1);
-            float q21 = (x_sample - x1) * (y2 - y_sample);
-            float q22 = (x_sample - x1) * (y_sample - y1);
+template <int N>
+glm::vec<N, float> Sampler::sample(float x, float y, glm::vec2 dx, glm::vec2 dy) const
+{
+    float out[N];
+    m_kernels[N - 1](*m_texture, m_fillColor, x, y, dx, dy, out);
+    glm::vec<N, float> result;
+    for (int c = 0; c < N; c++) result[c] = out[c];
+    return result;
+}
 
-            assert(q11 + q12 + q21 + q22 != 0);
+template glm::vec<1, float> Sampler::sample<1>(float x, float y, glm::vec2 dx, glm::vec2 dy) const;
+template glm::vec<2, float> Sampler::sample<2>(float x, float y, glm::vec2 dx, glm::vec2 dy) const;
+template glm::vec<3, float> Sampler::sample<3>(float x, float y, glm::vec2 dx, glm::vec2 dy) const;
+template glm::vec<4, float> Sampler::sample<4>(float x, float y, glm::vec2 dx, glm::vec2 dy) const;
 
-            RGB lerp{};
-            lerp.r = std::roundf(c11.r * q11 + c12.r * q12 + c21.r * q21 + c22.r * q22);
-            lerp.g = std::roundf(c11.g * q11 + c12.g * q12 + c21.g * q21 + c22.g * q22);
-            lerp.b = std::roundf(c11.b * q11 + c12.b * q12 + c21.b * q21 + c22.b * q22);
-            return glm::vec3(lerp.r / 255.f, lerp.g / 255.f, lerp.b / 255.f);
+template <int N, int Width>
+void Sampler::sample(const float* x, const float* y, const float* dxdX, const float* dydX, const float* dxdY, const float* dydY, float (&out)[N][Width]) const
+{
+    // no derivatives means the base level, as zero derivatives do
+    static const float zero[Width] = {};
+    if (dxdX == nullptr) {
+        dxdX = dydX = dxdY = dydY = zero;
+    }
+
+#if defined(SIMD_AVX2)
+    if constexpr (Width == 8) {
+        if (m_batchKernels[N - 1] != nullptr) {
+            m_batchKernels[N - 1](*m_texture, m_fillColor, x, y, dxdX, dydX, dxdY, dydY, &out[0][0]);
+            return;
         }
     }
-    return m_fillColor;
+#endif
+    for (int lane = 0; lane < Width; lane++) {
+        float texel[N];
+        m_kernels[N - 1](*m_texture, m_fillColor, x[lane], y[lane], glm::vec2(dxdX[lane], dydX[lane]), glm::vec2(dxdY[lane], dydY[lane]), texel);
+        for (int c = 0; c < N; c++) out[c][lane] = texel[c];
+    }
 }
 
-Sampler::Sampler(samplingMode sampling, wrappingMode wrapping)
+#define SAMPLER_BATCH(N, Width) \
+    template void Sampler::sample<N, Width>(const float* x, const float* y, const float* dxdX, const float* dydX, const float* dxdY, const float* dydY, float (&out)[N][Width]) const;
+SAMPLER_BATCH(1, 1) SAMPLER_BATCH(2, 1) SAMPLER_BATCH(3, 1) SAMPLER_BATCH(4, 1)
+SAMPLER_BATCH(1, 4) SAMPLER_BATCH(2, 4) SAMPLER_BATCH(3, 4) SAMPLER_BATCH(4, 4)
+SAMPLER_BATCH(1, 8) SAMPLER_BATCH(2, 8) SAMPLER_BATCH(3, 8) SAMPLER_BATCH(4, 8)
+#undef SAMPLER_BATCH
+
+void Sampler::select_kernels()
 {
-    m_texture = Texture();
-    m_sampleMode = sampling;
-    m_wrapMode = wrapping;
+    texelFormat format = m_texture->get_format();
+    Kernels kernels[4];
+    select_format<1>(format, m_sampleMode, m_wrapMode, kernels[0]);
+    select_format<2>(format, m_sampleMode, m_wrapMode, kernels[1]);
+    select_format<3>(format, m_sampleMode, m_wrapMode, kernels[2]);
+    select_format<4>(format, m_sampleMode, m_wrapMode, kernels[3]);
+    for (int n = 0; n < 4; n++) {
+        m_kernels[n] = kernels[n].kernel;
+        m_batchKernels[n] = kernels[n].batchKernel;
+    }
+    m_lodKernel = kernels[2].lodKernel;
+    // the gathers address texels with 32 bit byte offsets
+    if (m_texture->get_data_bytes() > size_t(INT_MAX) - sizeof(uint32_t)) {
+        for (BatchKernel& kernel : m_batchKernels) kernel = nullptr;
+    }
 }
 
-Sampler::Sampler(const char* path, samplingMode sampling, wrappingMode wrapping)
+namespace {
+    // a texture for a sampler of its own, with its mip chain built (while still unshared) for TRILINEAR
+    std::shared_ptr<const Texture> share(Texture&& texture, samplingMode sampling)
+    {
+        std::shared_ptr<Texture> shared = std::make_shared<Texture>(std::move(texture));
+        if (sampling == TRILINEAR) {
+            shared->generate_mipmaps();
+        }
+        return shared;
+    }
+}
+
+Sampler::Sampler(samplingMode sampling, wrappingMode wrapping) :
+    m_sampleMode(sampling),
+    m_wrapMode(wrapping),
+    m_texture(std::make_shared<const Texture>())
 {
-    m_texture = Texture(path);
-    m_sampleMode = sampling;
-    m_wrapMode = wrapping;
+    select_kernels();
 }
 
-Sampler::Sampler(Texture& texture, samplingMode sampling, wrappingMode wrapping) :
+Sampler::Sampler(const char* path, samplingMode sampling, wrappingMode wrapping, texelFormat format) :
     m_sampleMode(sampling),
     m_wrapMode(wrapping),
-    m_texture(texture)
-{}
\ No newline at end of file
+    m_texture(TextureRegistry::global().load(path, format, BLOCKED))
+{
+    select_kernels();
+}
+
+Sampler::Sampler(std::shared_ptr<const Texture> texture, samplingMode sampling, wrappingMode wrapping) :
+    m_sampleMode(sampling),
+    m_wrapMode(wrapping),
+    m_texture(std::move(texture))
+{
+    select_kernels();
+}
+
+Sampler::Sampler(const Texture& texture, samplingMode sampling, wrappingMode wrapping) :
+    Sampler(Texture(texture), sampling, wrapping)
+{
+}
+
+Sampler::Sampler(Texture&& texture, samplingMode sampling, wrappingMode wrapping) :
+    Sampler(share(std::move(texture), sampling), sampling, wrapping)
+{
+}
+
+void Sampler::setSamplingMode(samplingMode mode)
+{
+    m_sampleMode = mode;
+    select_kernels();
+}
+
+void Sampler::setWrappingMode(wrappingMode mode)
+{
+    m_wrapMode = mode;
+    select_kernels();
+}
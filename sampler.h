@@ -1,26 +1,68 @@
 #pragma once
 #include "texture.h"
+#include <memory>
 #include <glm/glm.hpp>
 
-enum samplingMode {NEAREST, BILINEAR};
+// TRILINEAR blends bilinear samples of the two mip levels nearest the level of detail, which is taken from the
+// derivatives of the texture coordinates when they are given (otherwise it samples the base level, as BILINEAR)
+enum samplingMode {NEAREST, BILINEAR, TRILINEAR};
 enum wrappingMode {CLAMPTOEDGE, REPEAT, MIRROR, FILL};
 
+// Samples a texture it shares (immutably) with anything else using it. Results are in [0, 1] for 8 bit texel formats, as stored for R32F. Channels
+// a format lacks read as (r, r, r, 1) for R8 and R32F, so single channel textures act as greyscale, and as
+// (r, g, 0, 1) for RG8
 class Sampler {
 private:
 	samplingMode m_sampleMode;
 	wrappingMode m_wrapMode;
-	Texture m_texture;
-	glm::vec3 m_fillColor = glm::vec3(0);
+	std::shared_ptr<const Texture> m_texture;
+	glm::vec4 m_fillColor = glm::vec4(0, 0, 0, 1);
+	// Kernels are compiled for every combination of texel format, sampling mode and wrapping mode, so that none of
+	// them is branched on per sample, and chosen by select_kernels whenever one changes. A SampleKernel samples one
+	// point given the derivatives of its coordinates, from which only TRILINEAR ones compute a level of detail, and a
+	// LodKernel at a given level of detail. A BatchKernel (AVX2 only) samples 8 points from arrays, as SampleKernel
+	// does, fetching their texels with gathers
+	typedef void (*SampleKernel)(const Texture& texture, const glm::vec4& fillColor, float x, float y, glm::vec2 dx, glm::vec2 dy, float* out);
+	typedef void (*LodKernel)(const Texture& texture, const glm::vec4& fillColor, float x, float y, float lod, float* out);
+	typedef void (*BatchKernel)(const Texture& texture, const glm::vec4& fillColor, const float* x, const float* y,
+		const float* dxdX, const float* dydX, const float* dxdY, const float* dydY, float* out);
+	// by channel count - 1
+	SampleKernel m_kernels[4];
+	BatchKernel m_batchKernels[4] = {};
+	LodKernel m_lodKernel; // 3 channels, for sampleLod
+	void select_kernels();
 public:
 	const glm::vec3 operator()(float x, float y);
+	// Samples at (x, y) given the change in the coordinates per pixel in x (dx) and in y (dy), as from
+	// FragmentQuad::dFdx and dFdy, from which TRILINEAR chooses the mip levels (other modes ignore them)
+	const glm::vec3 operator()(float x, float y, glm::vec2 dx, glm::vec2 dy);
+	// Samples with an explicit level of detail (0 being the base level) in TRILINEAR mode, as operator() otherwise
+	const glm::vec3 sampleLod(float x, float y, float lod);
+	// Samples just the first N (1 to 4) channels, e.g. sample<1> for a greyscale map, which saves filtering
+	// channels that would be thrown away. Derivatives as for operator(), zero meaning the base level
+	template <int N>
+	glm::vec<N, float> sample(float x, float y, glm::vec2 dx = glm::vec2(0.f), glm::vec2 dy = glm::vec2(0.f)) const;
+	// Samples the first N channels at Width points at once, e.g. the lanes of a FragmentBatch, writing channel c of
+	// point i to out[c][i]. x and y are the coordinates of each point, the rest their derivatives as for sample (or
+	// all null for the base level). With AVX2 and a Width of 8 the points are filtered together
+	template <int N, int Width>
+	void sample(const float* x, const float* y, const float* dxdX, const float* dydX, const float* dxdY, const float* dydY, float (&out)[N][Width]) const;
 	Sampler(samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE);
-	Sampler(const char* path, samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE);
-	Sampler(Texture& texture, samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE);
-	void setSamplingMode(samplingMode mode) { m_sampleMode = mode; }
-	void setWrappingMode(wrappingMode mode) { m_wrapMode = mode; }
-	void setFillColor(glm::vec3 col) { m_fillColor = col; }
+	// Uses the texture at path converted to format (see Texture::load_texture), loaded through
+	// TextureRegistry::global(), so samplers of the same file share one copy of it
+	Sampler(const char* path, samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE, texelFormat format = SOURCE_FORMAT);
+	Sampler(std::shared_ptr<const Texture> texture, samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE);
+	// samples a copy of texture of its own, with the mip chain built for TRILINEAR
+	Sampler(const Texture& texture, samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE);
+	// as above, but takes texture's texels rather than copying them
+	Sampler(Texture&& texture, samplingMode sampling = NEAREST, wrappingMode wrapping = CLAMPTOEDGE);
+	// TRILINEAR needs the texture's mip chain, which textures from the registry have; a texture without one is
+	// sampled at its base level
+	void setSamplingMode(samplingMode mode);
+	void setWrappingMode(wrappingMode mode);
+	void setFillColor(glm::vec3 col) { m_fillColor = glm::vec4(col, 1.f); }
 	// disable copy constructor, assignment operator and default constructor
 	Sampler(const Sampler&) = delete;
 	Sampler() = delete;
 	Sampler& operator=(const Sampler&) = delete;
-};
\ No newline at end of file
+};
@@ -1,11 +1,109 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <concepts>
+#include <type_traits>
+#include <cstddef>
 
 template <typename Vertex, typename Varying>
 struct IShaderProgram {
 	virtual Varying vertexShader(const Vertex& input) = 0 ;
 	virtual glm::vec3 fragmentShader(const Varying& interpolatedInput) = 0;
-	virtual Varying interpolate(const Varying& a, const Varying& b, const Varying& c, float ba, float bb, float bc) = 0;
 	template <typename Vertex, typename Varying>
 	friend class Renderer;
-};
\ No newline at end of file
+};
+
+// Requirements on any shader program passed to Renderer::draw. IShaderProgram meets them through virtual functions,
+// but a program need not derive from it at all. draw is instantiated for the exact program type it is given, so
+// if that type's shader functions are non-virtual (or the type is marked final) the calls are resolved statically
+// and can be inlined into the raster loop
+template <typename Program, typename Vertex, typename Varying>
+concept ShaderProgram = requires(Program& program, const Vertex& vertex, const Varying& varying) {
+	{ program.vertexShader(vertex) } -> std::convertible_to<Varying>;
+	{ program.fragmentShader(varying) } -> std::convertible_to<glm::vec3>;
+};
+
+// Varyings are interpolated by the renderer, which treats everything after gl_Position as a flat array of floats.
+// So a Varying must start with glm::vec4 gl_Position, followed only by float based members (float, glm::vec2,
+// glm::vec3, ...). Members that are not floats (ints, doubles, pointers) cannot be detected, so must be avoided
+template <typename Varying>
+concept FlatVarying = std::is_standard_layout_v<Varying> && std::is_trivially_copyable_v<Varying> &&
+	std::same_as<decltype(Varying::gl_Position), glm::vec4> && offsetof(Varying, gl_Position) == 0 &&
+	sizeof(Varying) % sizeof(float) == 0;
+
+// Any other Varying needs the program to interpolate it, by providing Varying interpolate(const Varying& a,
+// const Varying& b, const Varying& c, float ba, float bb, float bc), which is then used for FlatVaryings too. It
+// is only found on the type passed to draw, i.e. not when drawing through an IShaderProgram reference
+template <typename Program, typename Varying>
+concept CustomInterpolation = requires(Program& program, const Varying& varying, float weight) {
+	{ program.interpolate(varying, varying, varying, weight, weight, weight) } -> std::convertible_to<Varying>;
+};
+
+// The attribute floats of a FlatVarying, i.e. all of it after gl_Position
+template <typename Varying>
+struct VaryingAttributes {
+	static constexpr int COUNT = int(sizeof(Varying) / sizeof(float)) - 4;
+	static const float* get(const Varying& v) { return reinterpret_cast<const float*>(&v) + 4; }
+	static float* get(Varying& v) { return reinterpret_cast<float*>(&v) + 4; }
+};
+
+// Index into FragmentBatch::attributes of the first float of a member of a FlatVarying
+#define VARYING_ATTRIBUTE(Varying, member) (int(offsetof(Varying, member) / sizeof(float)) - 4)
+
+// Fragments are shaded in 2x2 quads, pixels (x, y), (x + 1, y), (x, y + 1) and (x + 1, y + 1) for even x and y, so
+// that derivatives of the varyings can be taken by finite differences across the quad (like GLSL's dFdxFine and
+// dFdyFine). Fragments of a quad not covered by the triangle are still interpolated as "helpers", extrapolating the
+// triangle's varyings, but never written. A program opts in by providing
+//     glm::vec3 fragmentShader(const FragmentQuad<Varying>& quad)
+// which is called for each covered fragment of the quad in turn, instead of the single fragment one. As with
+// interpolate, only found on the type passed to draw
+template <typename Varying>
+struct FragmentQuad {
+	Varying fragments[4]; // in the order above
+	int mask; // bit i set if fragments[i] is covered, i.e. is shaded and written
+	int index; // the fragment being shaded
+
+	const Varying& fragment() const { return fragments[index]; }
+	// change in a member of the Varying per pixel in x (along the fragment's row of the quad) and y (along its column)
+	template <typename T>
+	T dFdx(T Varying::* member) const { int row = index & 2; return fragments[row + 1].*member - fragments[row].*member; }
+	template <typename T>
+	T dFdy(T Varying::* member) const { int column = index & 1; return fragments[column + 2].*member - fragments[column].*member; }
+};
+
+template <typename Program, typename Varying>
+concept QuadFragmentShader = requires(Program& program, const FragmentQuad<Varying>& quad) {
+	{ program.fragmentShader(quad) } -> std::convertible_to<glm::vec3>;
+};
+
+// Up to Width fragments (adjacent pixels of a row) in structure of arrays form, for batched fragment shading.
+// Lanes not in mask hold valid (but meaningless) fragments of the same triangle, so can be shaded unconditionally.
+// As batches are cut from whole quads, each attribute's derivatives come with it
+template <typename Varying, int Width>
+struct FragmentBatch {
+	static constexpr int ATTRIBUTES = VaryingAttributes<Varying>::COUNT > 0 ? VaryingAttributes<Varying>::COUNT : 1;
+	int mask; // bit i set if lane i is a real fragment
+	float position[4][Width]; // gl_Position of each fragment, its window position as for single fragments
+	float attributes[ATTRIBUTES][Width];
+	float dFdx[ATTRIBUTES][Width], dFdy[ATTRIBUTES][Width]; // as FragmentQuad::dFdx/dFdy, per attribute
+
+	glm::vec2 vec2(int attribute, int lane) const { return glm::vec2(attributes[attribute][lane], attributes[attribute + 1][lane]); }
+	glm::vec3 vec3(int attribute, int lane) const {
+		return glm::vec3(attributes[attribute][lane], attributes[attribute + 1][lane], attributes[attribute + 2][lane]);
+	}
+};
+
+template <int Width>
+struct ColourBatch {
+	float r[Width], g[Width], b[Width];
+};
+
+// A program with a FlatVarying may additionally provide a batched fragment shader,
+//     template <int Width> void fragmentShader(const FragmentBatch<Varying, Width>& in, ColourBatch<Width>& out)
+// which the renderer then calls instead of the single fragment one, with Width its SIMD width (8 with AVX2, 4 with
+// SSE2, otherwise 1). Written as loops over the lanes, each step of the shader is computed for every fragment at
+// once and can be vectorized by the compiler. As with interpolate, only found on the type passed to draw
+template <typename Program, typename Varying, int Width>
+concept BatchedFragmentShader = FlatVarying<Varying> &&
+	requires(Program& program, const FragmentBatch<Varying, Width>& in, ColourBatch<Width>& out) {
+	program.fragmentShader(in, out);
+};
@@ -0,0 +1,224 @@
+#pragma once
+#include <cstdint>
+
+// Thin wrapper over whichever SIMD instruction set is enabled at compile time (AVX2, else SSE2, else plain
+// scalar code), exposing just the operations the rasterizer needs on WIDTH lanes at once. Lane masks are
+// plain ints with bit i set for lane i. Define DISABLE_SIMD to force the scalar fallback
+//#define DISABLE_SIMD
+
+#if defined(DISABLE_SIMD)
+// scalar fallback only
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+namespace simd {
+#if defined(SIMD_AVX2)
+	constexpr int WIDTH = 8;
+	typedef __m256i vint;
+	typedef __m256 vfloat;
+
+	inline vint splat(int x) { return _mm256_set1_epi32(x); }
+	inline vfloat splat(float x) { return _mm256_set1_ps(x); }
+	inline vfloat load(const float* src) { return _mm256_loadu_ps(src); }
+	// {0, step, 2*step, ...}
+	inline vint ramp(int s) { return _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s); }
+	inline vfloat ramp(float s) { return _mm256_mul_ps(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps(s)); }
+	inline vint add(vint a, vint b) { return _mm256_add_epi32(a, b); }
+	inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	inline vint bit_or(vint a, vint b) { return _mm256_or_si256(a, b); }
+	inline vint truncate(vfloat a) { return _mm256_cvttps_epi32(a); }
+	// lanes whose sign bit is set
+	inline int sign_mask(vint a) { return _mm256_movemask_ps(_mm256_castsi256_ps(a)); }
+	// all bits set in the lanes of laneMask, clear in the others
+	inline vint lane_vector(int laneMask) {
+		const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(laneMask), bits), bits);
+	}
+
+	// Depth test and write on WIDTH consecutive 16 bit values: for each lane in laneMask where value < dst,
+	// dst is overwritten with value (which must be non-negative, values above 65535 never pass). Returns the lanes that passed
+	inline int less_store_u16(uint16_t* dst, vint value, int laneMask) {
+		__m256i lanes = lane_vector(laneMask);
+		__m128i old16 = _mm_loadu_si128((const __m128i*)dst);
+		__m256i old = _mm256_cvtepu16_epi32(old16);
+		__m256i pass = _mm256_and_si256(_mm256_cmpgt_epi32(old, value), lanes);
+		int passMask = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+		if (passMask) {
+			__m256i blended = _mm256_blendv_epi8(old, value, pass);
+			// packus works within 128 bit halves, so gather the two useful 64 bit parts back together
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(blended, blended), 0x08);
+			_mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+		}
+		return passMask;
+	}
+
+	// Equal depth test (no write) on WIDTH consecutive 16 bit values: returns the lanes in laneMask where value == src
+	inline int equal_u16(const uint16_t* src, vint value, int laneMask) {
+		__m256i stored = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src));
+		return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(stored, value))) & laneMask;
+	}
+
+	// Stores all WIDTH lanes to consecutive 16 bit values, saturating as less_store_u16 does
+	inline void store_u16(uint16_t* dst, vint value) {
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(value, value), 0x08);
+		_mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+	}
+
+	// Stores the lanes of laneMask to consecutive 32 bit values, leaving the others untouched
+	inline void store_masked_u32(uint32_t* dst, vint value, int laneMask) {
+		_mm256_maskstore_epi32((int*)dst, lane_vector(laneMask), value);
+	}
+#elif defined(SIMD_SSE2)
+	constexpr int WIDTH = 4;
+	typedef __m128i vint;
+	typedef __m128 vfloat;
+
+	inline vint splat(int x) { return _mm_set1_epi32(x); }
+	inline vfloat splat(float x) { return _mm_set1_ps(x); }
+	inline vfloat load(const float* src) { return _mm_loadu_ps(src); }
+	inline vint ramp(int s) { return _mm_setr_epi32(0, s, 2 * s, 3 * s); }
+	inline vfloat ramp(float s) { return _mm_mul_ps(_mm_setr_ps(0, 1, 2, 3), _mm_set1_ps(s)); }
+	inline vint add(vint a, vint b) { return _mm_add_epi32(a, b); }
+	inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	inline vint bit_or(vint a, vint b) { return _mm_or_si128(a, b); }
+	inline vint truncate(vfloat a) { return _mm_cvttps_epi32(a); }
+	inline int sign_mask(vint a) { return _mm_movemask_ps(_mm_castsi128_ps(a)); }
+	inline vint lane_vector(int laneMask) {
+		const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+		return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(laneMask), bits), bits);
+	}
+
+	inline int less_store_u16(uint16_t* dst, vint value, int laneMask) {
+		__m128i lanes = lane_vector(laneMask);
+		__m128i old = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)dst), _mm_setzero_si128());
+		__m128i pass = _mm_and_si128(_mm_cmpgt_epi32(old, value), lanes);
+		int passMask = _mm_movemask_ps(_mm_castsi128_ps(pass));
+		if (passMask) {
+			__m128i blended = _mm_or_si128(_mm_and_si128(pass, value), _mm_andnot_si128(pass, old));
+			// SSE2 only has a signed saturating pack, so shift into the signed range and back again
+			__m128i packed = _mm_packs_epi32(_mm_sub_epi32(blended, _mm_set1_epi32(0x8000)), _mm_setzero_si128());
+			_mm_storel_epi64((__m128i*)dst, _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+		}
+		return passMask;
+	}
+
+	inline int equal_u16(const uint16_t* src, vint value, int laneMask) {
+		__m128i stored = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)src), _mm_setzero_si128());
+		return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(stored, value))) & laneMask;
+	}
+
+	inline void store_u16(uint16_t* dst, vint value) {
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(value, _mm_set1_epi32(0x8000)), _mm_setzero_si128());
+		_mm_storel_epi64((__m128i*)dst, _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+	}
+
+	// SSE2 has no masked store, so the untouched lanes are written back as they were
+	inline void store_masked_u32(uint32_t* dst, vint value, int laneMask) {
+		__m128i lanes = lane_vector(laneMask);
+		__m128i old = _mm_loadu_si128((const __m128i*)dst);
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_and_si128(lanes, value), _mm_andnot_si128(lanes, old)));
+	}
+#else
+	constexpr int WIDTH = 1;
+	typedef int vint;
+	typedef float vfloat;
+
+	inline vint splat(int x) { return x; }
+	inline vfloat splat(float x) { return x; }
+	inline vfloat load(const float* src) { return *src; }
+	inline vint ramp(int) { return 0; }
+	inline vfloat ramp(float) { return 0.f; }
+	inline vint add(vint a, vint b) { return a + b; }
+	inline vfloat add(vfloat a, vfloat b) { return a + b; }
+	inline vfloat mul(vfloat a, vfloat b) { return a * b; }
+	inline vint bit_or(vint a, vint b) { return a | b; }
+	inline vint truncate(vfloat a) { return int(a); }
+	inline int sign_mask(vint a) { return a < 0 ? 1 : 0; }
+
+	inline int less_store_u16(uint16_t* dst, vint value, int laneMask) {
+		if (laneMask && value < *dst) {
+			*dst = uint16_t(value);
+			return 1;
+		}
+		return 0;
+	}
+
+	inline int equal_u16(const uint16_t* src, vint value, int laneMask) {
+		return laneMask && value == *src ? 1 : 0;
+	}
+
+	inline void store_u16(uint16_t* dst, vint value) {
+		*dst = uint16_t(value);
+	}
+
+	inline void store_masked_u32(uint32_t* dst, vint value, int laneMask) {
+		if (laneMask) {
+			*dst = uint32_t(value);
+		}
+	}
+#endif
+
+	// Packs WIDTH colours, with channels in [0, 1] (clamped otherwise), into 8 bit RGBA values with R in the lowest
+	// byte and alpha 255, rounding each channel to the nearest of 0..255
+	inline vint pack_unorm8(vfloat r, vfloat g, vfloat b) {
+#if defined(SIMD_AVX2)
+		auto unorm8 = [](__m256 c) {
+			c = _mm256_min_ps(_mm256_max_ps(c, _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+			return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.f)), _mm256_set1_ps(0.5f)));
+		};
+		__m256i rgba = _mm256_or_si256(unorm8(r), _mm256_slli_epi32(unorm8(g), 8));
+		rgba = _mm256_or_si256(rgba, _mm256_slli_epi32(unorm8(b), 16));
+		return _mm256_or_si256(rgba, _mm256_set1_epi32(int(0xFF000000)));
+#elif defined(SIMD_SSE2)
+		auto unorm8 = [](__m128 c) {
+			c = _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(1.f));
+			return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(255.f)), _mm_set1_ps(0.5f)));
+		};
+		__m128i rgba = _mm_or_si128(unorm8(r), _mm_slli_epi32(unorm8(g), 8));
+		rgba = _mm_or_si128(rgba, _mm_slli_epi32(unorm8(b), 16));
+		return _mm_or_si128(rgba, _mm_set1_epi32(int(0xFF000000)));
+#else
+		auto unorm8 = [](float c) {
+			c = c > 0.f ? (c < 1.f ? c : 1.f) : 0.f;
+			return uint32_t(c * 255.f + 0.5f);
+		};
+		return int(unorm8(r) | unorm8(g) << 8 | unorm8(b) << 16 | 0xFF000000u);
+#endif
+	}
+
+	// Perspective divide and viewport transform of a single clip space position (x, y, z, w), in place:
+	// xyz become ((xyz / w) + 1) * scale / 2 and w becomes 1/w. Works on the 4 components at once whenever
+	// SSE is available, with results identical to the scalar form
+	inline void project(float* position, float scaleX, float scaleY, float scaleZ) {
+#if defined(SIMD_AVX2) || defined(SIMD_SSE2)
+		__m128 p = _mm_loadu_ps(position);
+		__m128 w = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 screen = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(p, w), _mm_set1_ps(1.f)),
+			_mm_setr_ps(scaleX, scaleY, scaleZ, 0.f)), _mm_set1_ps(0.5f));
+		__m128 invW = _mm_div_ss(_mm_set_ss(1.f), w);
+		// (x, y, z, 1/w), via (z, z, 1/w, 1/w) as SSE2 has no blend
+		__m128 zw = _mm_shuffle_ps(screen, invW, _MM_SHUFFLE(0, 0, 2, 2));
+		_mm_storeu_ps(position, _mm_shuffle_ps(screen, zw, _MM_SHUFFLE(2, 0, 1, 0)));
+#else
+		float w = position[3];
+		position[0] = (position[0] / w + 1.f) * scaleX * 0.5f;
+		position[1] = (position[1] / w + 1.f) * scaleY * 0.5f;
+		position[2] = (position[2] / w + 1.f) * scaleZ * 0.5f;
+		position[3] = 1.f / w;
+#endif
+	}
+
+	// mask with the lanes [first, last] set (empty if last < first)
+	inline int lane_range(int first, int last) {
+		first = first < 0 ? 0 : first;
+		last = last > WIDTH - 1 ? WIDTH - 1 : last;
+		return last < first ? 0 : ((2 << last) - 1) & ~((1 << first) - 1);
+	}
+}
@@ -1,6 +1,49 @@
 #include "texture.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
 
+namespace {
+	// Texel memory is aligned to a cache line, with a word of (zeroed) slack past its end so that any texel can be
+	// read as a 32 bit word. Each allocation keeps its size in the cache line before it, so stb can realloc it
+	constexpr size_t TEXEL_ALIGNMENT = 64;
+
+	void* texel_malloc(size_t bytes)
+	{
+		uint8_t* block = static_cast<uint8_t*>(::operator new[](TEXEL_ALIGNMENT + bytes + sizeof(uint32_t), std::align_val_t(TEXEL_ALIGNMENT), std::nothrow));
+		if (block == nullptr) return nullptr;
+		memcpy(block, &bytes, sizeof(size_t));
+		memset(block + TEXEL_ALIGNMENT + bytes, 0, sizeof(uint32_t));
+		return block + TEXEL_ALIGNMENT;
+	}
+
+	void texel_free(void* data)
+	{
+		if (data != nullptr) {
+			::operator delete[](static_cast<uint8_t*>(data) - TEXEL_ALIGNMENT, std::align_val_t(TEXEL_ALIGNMENT));
+		}
+	}
+
+	void* texel_realloc(void* data, size_t bytes)
+	{
+		void* resized = texel_malloc(bytes);
+		if (resized != nullptr && data != nullptr) {
+			size_t oldBytes;
+			memcpy(&oldBytes, static_cast<uint8_t*>(data) - TEXEL_ALIGNMENT, sizeof(size_t));
+			memcpy(resized, data, std::min(oldBytes, bytes));
+			texel_free(data);
+		}
+		return resized;
+	}
+}
+
+// stb loads images into texel memory, so that a buffer it returns already laid out as the texture is stored can be
+// kept as it is
+#define STBI_MALLOC(bytes) texel_malloc(bytes)
+#define STBI_REALLOC(data, bytes) texel_realloc(data, bytes)
+#define STBI_FREE(data) texel_free(data)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -11,37 +54,91 @@ Texture::Texture()
 	m_data = nullptr;
 }
 
-Texture::Texture(const char* path)
+Texture::Texture(const char* path, texelFormat format, texelLayout layout)
 {
 	m_width = 0;
 	m_height = 0;
 	m_data = nullptr;
-	load_texture(path);
+	load_texture(path, format, layout);
 }
 
 Texture::~Texture()
 {
-	delete[] m_data;
+	release(m_data);
 }
 
 // No bounds checking on retrival, so take same care as one would with a regular array access
-const RGB& Texture::operator()(int x, int y) const
+RGB Texture::operator()(int x, int y) const
 {
-	return m_data[y * m_width + x];
+	const uint8_t* t = texel(x, y, 0);
+	switch (m_format) {
+		case R8:
+			return RGB{ t[0], t[0], t[0] };
+		case RG8:
+			return RGB{ t[0], t[1], 0 };
+		case R32F: {
+			float value;
+			memcpy(&value, t, sizeof(float));
+			uint8_t grey = uint8_t(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+			return RGB{ grey, grey, grey };
+		}
+		default:
+			return RGB{ t[0], t[1], t[2] };
+	}
 }
 
-void Texture::load_texture(const char* path)
+Texture::MipLevel Texture::make_level(int width, int height, size_t offset) const
 {
-	// if texture already loaded, delete old texture
-	if (m_data != nullptr) {
-		delete[] m_data;
-		m_width = 0;
-		m_height = 0;
+	if (m_layout == BLOCKED) {
+		int blocksX = (width + TEXEL_BLOCK_SIZE - 1) >> TEXEL_BLOCK_BITS, blocksY = (height + TEXEL_BLOCK_SIZE - 1) >> TEXEL_BLOCK_BITS;
+		return MipLevel{ width, height, blocksX, offset, size_t(blocksX) * blocksY * TEXEL_BLOCK_SIZE * TEXEL_BLOCK_SIZE };
 	}
+	return MipLevel{ width, height, 0, offset, size_t(width) * height };
+}
+
+// zero filled, so that any padding texels are defined
+uint8_t* Texture::allocate(size_t bytes)
+{
+	uint8_t* data = static_cast<uint8_t*>(texel_malloc(bytes));
+	if (data == nullptr) throw std::bad_alloc();
+	memset(data, 0, bytes);
+	return data;
+}
+
+void Texture::release(uint8_t* data)
+{
+	texel_free(data);
+}
+
+void Texture::unload()
+{
+	release(m_data);
+	m_data = nullptr;
+	m_width = 0;
+	m_height = 0;
+	m_levels.clear();
+}
+
+void Texture::load_texture(const char* path, texelFormat format, texelLayout layout)
+{
+	// if texture already loaded, delete old texture
+	unload();
 
 	int width, height, channels;
-	stbi_set_flip_vertically_on_load(1);
-	uint8_t* data = stbi_load(path, &width, &height, &channels, 3);
+	// the per thread flag, as textures may be loaded on several threads at once
+	stbi_set_flip_vertically_on_load_thread(1);
+	if (!stbi_info(path, &width, &height, &channels)) {
+		std::cout << "Error loading texture:" << path << std::endl;
+		return;
+	}
+	if (format == SOURCE_FORMAT) {
+		format = channels == 1 ? R8 : RGBA8;
+	}
+	// stb converts to the channel count asked for: 1 gives luminance, 4 adds opaque alpha (of which RG8 keeps the
+	// first two). Only HDR images are loaded as floats, as stb would otherwise apply a gamma curve to LDR ones
+	bool loadFloat = format == R32F && stbi_is_hdr(path);
+	int loadChannels = format == RG8 || format == RGBA8 ? 4 : 1;
+	void* data = loadFloat ? (void*)stbi_loadf(path, &width, &height, &channels, 1) : (void*)stbi_load(path, &width, &height, &channels, loadChannels);
 	if (data == nullptr) {
 		std::cout << "Error loading texture:" << path << std::endl;
 		return;
@@ -49,36 +146,137 @@ void Texture::load_texture(const char* path)
 
 	m_width = width;
 	m_height = height;
-	m_data = new RGB[width * height];
-	for (int i = 0; i < width * height; i++) {
-		m_data[i] = RGB{ data[3 * i], data[3 * i + 1], data[3 * i + 2] };
+	m_format = format;
+	m_texelBytes = texel_bytes(format);
+	m_layout = layout;
+	m_levels.push_back(make_level(width, height, 0));
+
+	// stb's buffer is kept when it is already what would be stored: row-major, with the texel size of the format
+	bool adopt = layout == ROW_MAJOR && (loadFloat || (format != R32F && loadChannels == m_texelBytes));
+	if (adopt) {
+		m_data = static_cast<uint8_t*>(data);
+		return;
+	}
+	m_data = allocate(texel_count() * m_texelBytes);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t i = size_t(y) * width + x;
+			uint8_t* dst = m_data + texel_index(x, y, m_levels[0]) * m_texelBytes;
+			if (format == R32F) {
+				float value = loadFloat ? static_cast<float*>(data)[i] : static_cast<uint8_t*>(data)[i] / 255.f;
+				memcpy(dst, &value, sizeof(float));
+			}
+			else {
+				memcpy(dst, static_cast<uint8_t*>(data) + i * loadChannels, m_texelBytes);
+			}
+		}
 	}
 
 	stbi_image_free(data);
 }
 
+void Texture::generate_mipmaps()
+{
+	if (m_levels.size() != 1) return;
+
+	// lay out the whole chain, then move the base level into the start of it
+	while (m_levels.back().width > 1 || m_levels.back().height > 1) {
+		const MipLevel& above = m_levels.back();
+		m_levels.push_back(make_level(std::max(above.width / 2, 1), std::max(above.height / 2, 1), above.offset + above.size));
+	}
+	uint8_t* data = allocate(texel_count() * m_texelBytes);
+	memcpy(data, m_data, m_levels[0].size * m_texelBytes);
+	release(m_data);
+	m_data = data;
+
+	// Each texel averages the 2x2 texels above it. Where a level above has an odd size its last row or column is
+	// dropped, except at a size of 1, where it is used twice
+	for (int i = 1; i < (int)m_levels.size(); i++) {
+		const MipLevel& above = m_levels[i - 1];
+		const MipLevel& level = m_levels[i];
+		for (int y = 0; y < level.height; y++) {
+			int y0 = std::min(2 * y, above.height - 1), y1 = std::min(2 * y + 1, above.height - 1);
+			for (int x = 0; x < level.width; x++) {
+				int x0 = std::min(2 * x, above.width - 1), x1 = std::min(2 * x + 1, above.width - 1);
+				const uint8_t* c00 = texel(x0, y0, i - 1);
+				const uint8_t* c10 = texel(x1, y0, i - 1);
+				const uint8_t* c01 = texel(x0, y1, i - 1);
+				const uint8_t* c11 = texel(x1, y1, i - 1);
+				uint8_t* dst = m_data + texel_index(x, y, level) * m_texelBytes;
+				if (m_format == R32F) {
+					float v00, v10, v01, v11;
+					memcpy(&v00, c00, sizeof(float));
+					memcpy(&v10, c10, sizeof(float));
+					memcpy(&v01, c01, sizeof(float));
+					memcpy(&v11, c11, sizeof(float));
+					float average = (v00 + v10 + v01 + v11) * 0.25f;
+					memcpy(dst, &average, sizeof(float));
+				}
+				else {
+					for (int c = 0; c < m_texelBytes; c++) {
+						dst[c] = uint8_t((c00[c] + c10[c] + c01[c] + c11[c] + 2) >> 2);
+					}
+				}
+			}
+		}
+	}
+}
+
 // Copy constructor
 Texture::Texture(const Texture& toCopy)
 {
 	m_width = toCopy.m_width;
 	m_height = toCopy.m_height;
-	m_data = new RGB[m_width * m_height];
-	memcpy(m_data, toCopy.m_data, sizeof(RGB) * m_width * m_height);
+	m_format = toCopy.m_format;
+	m_texelBytes = toCopy.m_texelBytes;
+	m_layout = toCopy.m_layout;
+	m_levels = toCopy.m_levels;
+	m_data = allocate(texel_count() * m_texelBytes);
+	memcpy(m_data, toCopy.m_data, texel_count() * m_texelBytes);
+}
+
+Texture::Texture(Texture&& toMove) noexcept :
+	m_width(std::exchange(toMove.m_width, 0)),
+	m_height(std::exchange(toMove.m_height, 0)),
+	m_format(toMove.m_format),
+	m_texelBytes(toMove.m_texelBytes),
+	m_layout(toMove.m_layout),
+	m_data(std::exchange(toMove.m_data, nullptr)),
+	m_levels(std::move(toMove.m_levels))
+{
+	toMove.m_levels.clear();
+}
+
+Texture& Texture::operator=(Texture&& toMove) noexcept
+{
+	if (this == &toMove) return *this;
+	unload();
+
+	m_width = std::exchange(toMove.m_width, 0);
+	m_height = std::exchange(toMove.m_height, 0);
+	m_format = toMove.m_format;
+	m_texelBytes = toMove.m_texelBytes;
+	m_layout = toMove.m_layout;
+	m_data = std::exchange(toMove.m_data, nullptr);
+	m_levels = std::move(toMove.m_levels);
+	toMove.m_levels.clear();
+	return *this;
 }
 
 // Assignment operator
 Texture& Texture::operator=(const Texture& toCopy)
 {
+	if (this == &toCopy) return *this;
 	// if texture already loaded, delete old texture
-	if (m_data != nullptr) {
-		delete[] m_data;
-		m_width = 0;
-		m_height = 0;
-	}
+	unload();
 
 	m_width = toCopy.m_width;
 	m_height = toCopy.m_height;
-	m_data = new RGB[m_width * m_height];
-	memcpy(m_data, toCopy.m_data, sizeof(RGB) * m_width * m_height);
+	m_format = toCopy.m_format;
+	m_texelBytes = toCopy.m_texelBytes;
+	m_layout = toCopy.m_layout;
+	m_levels = toCopy.m_levels;
+	m_data = allocate(texel_count() * m_texelBytes);
+	memcpy(m_data, toCopy.m_data, texel_count() * m_texelBytes);
 	return *this;
-}
\ No newline at end of file
+}
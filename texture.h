@@ -1,24 +1,96 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <vector>
 
 struct RGB {
 	uint8_t r, g, b;
 };
 
+// How texels are ordered in memory. ROW_MAJOR is the image's own order. BLOCKED groups them into 4x4 blocks, each
+// contiguous and row-major inside, in row-major order of blocks (each level padded to whole blocks). A bilinear
+// footprint then usually lies in a single block, and a walk across the texture in any direction moves through
+// memory at the same rate, rather than a row apart per step in y
+enum texelLayout {ROW_MAJOR, BLOCKED};
+
+// How each texel is stored: 8 bits per channel with 1, 2 or 4 channels, or a single 32 bit float. RGB images are
+// stored as RGBA8 (alpha 255), so texels stay 4 byte aligned and a BLOCKED 4x4 block is exactly a cache line.
+// SOURCE_FORMAT, when loading, keeps the channels of the image file: R8 for greyscale, RGBA8 for anything with
+// colour or alpha. R32F is only used when asked for, and keeps the full range of HDR images
+enum texelFormat {R8, RG8, RGBA8, R32F, SOURCE_FORMAT};
+
+// An image, optionally with a chain of mip levels (each half the size of the one before, down to 1x1) for
+// filtering minified textures. All levels are stored in one allocation, the base level first
 class Texture {
+public:
+	static constexpr int TEXEL_BLOCK_BITS = 2;
+	static constexpr int TEXEL_BLOCK_SIZE = 1 << TEXEL_BLOCK_BITS;
+	struct MipLevel {
+		int width, height;
+		int blocksX; // BLOCKED only
+		size_t offset; // of the level's first texel in m_data, in texels
+		size_t size; // texels stored for the level, including any padding
+	};
 private:
 	int m_width, m_height;
-	RGB* m_data;
+	texelFormat m_format = RGBA8;
+	int m_texelBytes = 4;
+	texelLayout m_layout = BLOCKED;
+	uint8_t* m_data; // aligned to a cache line, from allocate
+	std::vector<MipLevel> m_levels; // just the base level until generate_mipmaps is called
+	// texels in all levels
+	size_t texel_count() const {
+		return m_levels.empty() ? 0 : m_levels.back().offset + m_levels.back().size;
+	}
+	MipLevel make_level(int width, int height, size_t offset) const;
+	size_t texel_index(int x, int y, const MipLevel& mip) const {
+		if (m_layout == BLOCKED) {
+			size_t block = size_t(y >> TEXEL_BLOCK_BITS) * mip.blocksX + (x >> TEXEL_BLOCK_BITS);
+			return mip.offset + (block << (2 * TEXEL_BLOCK_BITS)) + ((y & (TEXEL_BLOCK_SIZE - 1)) << TEXEL_BLOCK_BITS) + (x & (TEXEL_BLOCK_SIZE - 1));
+		}
+		return mip.offset + size_t(y) * mip.width + x;
+	}
+	// Texel memory, which stb also loads images into, so that its buffer can become a texture's own
+	static uint8_t* allocate(size_t bytes);
+	static void release(uint8_t* data);
+	void unload();
 public:
 	Texture();
 	~Texture();
-	Texture(const char* path);
-	const RGB& operator()(int x, int y) const;
-	void load_texture(const char* path);
+	Texture(const char* path, texelFormat format = SOURCE_FORMAT, texelLayout layout = BLOCKED);
+	// Texel (x, y) of the base level as 8 bit RGB, R8 and R32F read as grey and RG8 with blue 0. For inspecting a
+	// texture rather than sampling it
+	RGB operator()(int x, int y) const;
+	// The bytes of texel (x, y) of the given mip level, laid out as its format (R32F in native byte order). No
+	// bounds checking, so take same care as one would with a regular array access
+	const uint8_t* texel(int x, int y, int level) const {
+		return m_data + texel_index(x, y, m_levels[level]) * m_texelBytes;
+	}
+	// Loads an image file, converting it to format. A format with fewer channels than the image keeps the first
+	// ones, except for R8 and R32F from a colour image, which take its luminance
+	void load_texture(const char* path, texelFormat format = SOURCE_FORMAT, texelLayout layout = BLOCKED);
+	// Builds the mip chain, each level box filtered from the one above it, if it is not built already
+	void generate_mipmaps();
 
 	Texture(const Texture& toCopy);
 	Texture& operator=(const Texture& toCopy);
+	// moving takes the texels, leaving the moved from texture empty
+	Texture(Texture&& toMove) noexcept;
+	Texture& operator=(Texture&& toMove) noexcept;
 
-	int get_height() { return m_height; }
-	int get_width() { return m_width; }
-};
\ No newline at end of file
+	int get_height() const { return m_height; }
+	int get_width() const { return m_width; }
+	int get_height(int level) const { return m_levels[level].height; }
+	int get_width(int level) const { return m_levels[level].width; }
+	// number of mip levels, including the base level (0 if no texture is loaded)
+	int get_levels() const { return (int)m_levels.size(); }
+	// For code that addresses texels itself (as texel does), e.g. to fetch several at once: where each level is, and
+	// all of the texel data. Any texel can be read as a 32 bit word, as the data has slack past its end
+	const MipLevel& get_level(int level) const { return m_levels[level]; }
+	const uint8_t* get_data() const { return m_data; }
+	size_t get_data_bytes() const { return texel_count() * m_texelBytes; }
+	texelLayout get_layout() const { return m_layout; }
+	texelFormat get_format() const { return m_format; }
+	// bytes per texel of a format (other than SOURCE_FORMAT)
+	static int texel_bytes(texelFormat format) { return format == R8 ? 1 : format == RG8 ? 2 : 4; }
+};
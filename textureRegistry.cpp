@@ -0,0 +1,56 @@
+#include "textureRegistry.h"
+#include <iterator>
+
+std::shared_ptr<const Texture> TextureRegistry::load(const char* path, texelFormat format, texelLayout layout)
+{
+	// The lock is only held to look up and update the entry, not while loading, so that loading one file does not
+	// hold up threads asking for others. Threads asking for a file being loaded wait for it rather than loading it again
+	Key key(path, format, layout);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Entry& entry = m_textures[key];
+	if (std::shared_ptr<const Texture> texture = entry.texture.lock()) {
+		return texture;
+	}
+	if (entry.loading.valid()) {
+		std::shared_future<std::shared_ptr<const Texture>> loading = entry.loading;
+		lock.unlock();
+		return loading.get();
+	}
+	std::promise<std::shared_ptr<const Texture>> loaded;
+	entry.loading = loaded.get_future().share();
+
+	// drop the entries of textures no longer in use while here (entry is being loaded, so stays)
+	for (auto it = m_textures.begin(); it != m_textures.end();) {
+		it = it->second.texture.expired() && !it->second.loading.valid() ? m_textures.erase(it) : std::next(it);
+	}
+	lock.unlock();
+
+	std::shared_ptr<Texture> texture = std::make_shared<Texture>(path, format, layout);
+	texture->generate_mipmaps();
+
+	lock.lock();
+	entry.loading = std::shared_future<std::shared_ptr<const Texture>>();
+	// an empty texture is handed to those waiting for it, but not kept
+	if (texture->get_levels() != 0) {
+		entry.texture = texture;
+	}
+	lock.unlock();
+	loaded.set_value(texture);
+	return texture;
+}
+
+int TextureRegistry::size()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int loaded = 0;
+	for (const auto& entry : m_textures) {
+		loaded += entry.second.texture.expired() ? 0 : 1;
+	}
+	return loaded;
+}
+
+TextureRegistry& TextureRegistry::global()
+{
+	static TextureRegistry registry;
+	return registry;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "texture.h"
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+// Hands out textures loaded from files for sharing: each file is loaded once per texel format and layout, with its
+// mip chain built so that it serves samplers in every sampling mode, and every sampler (in every shader program)
+// asking for the same again gets the same immutable copy. The registry only holds weak references, so a texture is
+// freed with its last user, and loaded again if it is asked for after that. Safe to use from several threads
+class TextureRegistry {
+private:
+	typedef std::tuple<std::string, texelFormat, texelLayout> Key;
+	struct Entry {
+		std::weak_ptr<const Texture> texture;
+		// set while the texture is being loaded, for others asking for it meanwhile to wait on
+		std::shared_future<std::shared_ptr<const Texture>> loading;
+	};
+	std::map<Key, Entry> m_textures;
+	std::mutex m_mutex;
+public:
+	// The texture at path converted to format (see Texture::load_texture), with its mip chain. A file that fails to
+	// load gives an empty texture, which is not kept
+	std::shared_ptr<const Texture> load(const char* path, texelFormat format = SOURCE_FORMAT, texelLayout layout = BLOCKED);
+	// textures currently loaded, i.e. still in use
+	int size();
+
+	// the registry Sampler loads its textures through
+	static TextureRegistry& global();
+};
@@ -1,8 +1,12 @@
 #include "External/tgaimage.h"
 #include "texture.h"
 #include "sampler.h"
+#include "textureRegistry.h"
 #include "examples.h"
 
+#include <iostream>
+#include <utility>
+
 namespace TextureTests {
 	void BasicTextureTest(int width, int height, Texture& myTexture)
 	{
@@ -113,6 +117,37 @@ namespace TextureTests {
 		textureImageUpscaled.write_tga_file("sampler_upscale_test_bilinear.tga");
 	}
 
+	void SamplerTrilinearDownscalingTest(Sampler& mySampler, int height, int width, TGAImage& textureImageDownscaled)
+	{
+		mySampler.setSamplingMode(TRILINEAR);
+		// each pixel of the quarter size image covers 4x4 texels, so should be filtered from mip level 2
+		glm::vec2 dx(4.f / width, 0.f), dy(0.f, 4.f / height);
+		for (int y = 0; y < height / 4; y++) {
+			for (int x = 0; x < width / 4; x++) {
+				float x_sample = (x + 0.5f) / (width / 4);
+				float y_sample = (y + 0.5f) / (height / 4);
+				glm::vec3 col = mySampler(x_sample, y_sample, dx, dy);
+				col = col * glm::vec3(255) + glm::vec3(0.5); // convert from [0.f,1.f] colourspace to [0, 255] for TGAColor
+				textureImageDownscaled.set(x, y, TGAColor(col.x, col.y, col.z, 1));
+			}
+		}
+		textureImageDownscaled.flip_vertically(); // so that origin (0,0) is bottom left, not top left
+		textureImageDownscaled.write_tga_file("sampler_downscale_test_trilinear.tga");
+	}
+
+	void TextureRegistrySharingTest(const char* path)
+	{
+		TextureRegistry registry;
+		std::shared_ptr<const Texture> first = registry.load(path);
+		std::shared_ptr<const Texture> second = registry.load(path);
+		std::cout << "Texture registry: same file " << (first == second ? "shared" : "NOT shared")
+			<< ", mip chain " << (first->get_levels() > 1 ? "built" : "NOT built")
+			<< ", " << registry.size() << " loaded" << (registry.size() == 1 ? "" : " (NOT 1)") << std::endl;
+		first.reset();
+		second.reset();
+		std::cout << "Texture registry: " << registry.size() << " loaded once unused" << std::endl;
+	}
+
 	int runTests()
 	{
 		std::string str = "Resources\\apples.jpg";
@@ -124,7 +159,9 @@ namespace TextureTests {
 		BasicTextureTest(width, height, myTexture);
 
 		// ----- Basic Sampler functionality -----
-		Sampler mySampler(myTexture, NEAREST, CLAMPTOEDGE);
+		// built up front, as the sampler is switched to TRILINEAR below; the sampler then takes the texture over
+		myTexture.generate_mipmaps();
+		Sampler mySampler(std::move(myTexture), NEAREST, CLAMPTOEDGE);
 		TGAImage textureImageGrid(width * 3, height * 3, TGAImage::RGB);
 		
 		SamplerClampWrappingTest(height, width, mySampler, textureImageGrid);
@@ -138,6 +175,14 @@ namespace TextureTests {
 		SamplerNearestUpscalingTest(mySampler, height, width, textureImageUpscaled);
 		SamplerBilinearUpscalingTest(mySampler, height, width, textureImageUpscaled);
 
+		// ----- Sampler trilinear (mipmapped) downscaling test -----
+		TGAImage textureImageDownscaled(width / 4, height / 4, TGAImage::RGB);
+
+		SamplerTrilinearDownscalingTest(mySampler, height, width, textureImageDownscaled);
+
+		// ----- Texture registry sharing test -----
+		TextureRegistrySharingTest(str.c_str());
+
 		return 0;
 	}
 }
\ No newline at end of file
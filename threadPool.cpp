@@ -0,0 +1,80 @@
+#include "threadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (int i = 0; i < threadCount - 1; i++) {
+		m_workers.emplace_back(&ThreadPool::worker_loop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)>& task)
+{
+	if (count <= 0) return;
+	// not worth waking anyone up for a single task
+	if (m_workers.empty() || count == 1) {
+		for (int i = 0; i < count; i++) {
+			task(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_count = count;
+		m_next = 0;
+		m_busyWorkers = (int)m_workers.size();
+		m_generation++;
+	}
+	m_wake.notify_all();
+	run_tasks();
+
+	// every worker must have checked in before returning, otherwise a straggler could still pick up
+	// indices of this job once the next one has started
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_busyWorkers == 0; });
+	m_task = nullptr;
+}
+
+void ThreadPool::run_tasks()
+{
+	for (int i = m_next++; i < m_count; i = m_next++) {
+		(*m_task)(i);
+	}
+}
+
+void ThreadPool::worker_loop()
+{
+	unsigned seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this, seenGeneration] { return m_stop || m_generation != seenGeneration; });
+			if (m_stop) return;
+			seenGeneration = m_generation;
+		}
+		run_tasks();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_busyWorkers == 0) {
+				m_done.notify_one();
+			}
+		}
+	}
+}
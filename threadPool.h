@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Minimal persistent pool of worker threads for data parallel loops. The calling thread takes part in the
+// work too, so a pool of N threads runs N-1 workers
+class ThreadPool {
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const std::function<void(int)>* m_task = nullptr;
+	int m_count = 0;
+	std::atomic<int> m_next{ 0 };
+	int m_busyWorkers = 0;
+	unsigned m_generation = 0; // incremented per parallel_for so sleeping workers know there is new work
+	bool m_stop = false;
+	void worker_loop();
+	void run_tasks();
+public:
+	// threadCount <= 0 uses one thread per hardware thread
+	ThreadPool(int threadCount = 0);
+	~ThreadPool();
+	int size() const { return (int)m_workers.size() + 1; }
+	// Calls task(i) for every i in [0, count), spread across the pool, and returns once all calls have completed.
+	// Indices are handed out dynamically in increasing order. Not re-entrant: task must not call parallel_for
+	void parallel_for(int count, const std::function<void(int)>& task);
+	// disable copy constructor and assignment operator
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+};